@@ -0,0 +1,383 @@
+#include "runtype.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace runtype;
+
+using B = BasicWithDefaultResolver<int, double, std::string>;
+using BR = B::Resolver;
+template <>
+const BR::BasicMapType BR::basicTypes = makeTypeMap<B>(
+    {"int", "double", "string"});
+
+using StringIntMap = detail::OrderPreservingMap<std::string, int>;
+using CompactStringIntMap =
+    detail::CompactOrderPreservingMap<std::string, int>;
+
+namespace {
+
+// Same shapes as the types in test_runtype.cpp
+const auto multiType = CompoundType("multiType",
+    {{"i", {"int"}},
+        {"d", {"double"}},
+        {"s1", {"string"}},
+        {"s2", {"string"}}});
+const auto nestedType =
+    CompoundType("nestedType", {{"i", {"int"}}, {"m", {"multiType"}}});
+
+const std::string multiRecord = "10 3.7 hello world ";
+const std::string nestedRecord = "6 10 3.7 hello world ";
+
+void registerTypes() {
+    BR::registerCompoundType(multiType);
+    BR::registerCompoundType(nestedType);
+}
+
+// A stream containing the record many times, so that benchmarks only
+// have to rewind it occasionally
+class RepeatedStream {
+    std::stringstream ss_;
+    std::size_t count_;
+    std::size_t remaining_;
+
+public:
+    RepeatedStream(const std::string& record, std::size_t count = 1024)
+        : count_(count), remaining_(count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            ss_ << record;
+        }
+    }
+
+    std::istream& next() {
+        if (remaining_ == 0) {
+            ss_.clear();
+            ss_.seekg(0);
+            remaining_ = count_;
+        }
+        --remaining_;
+        return ss_;
+    }
+};
+
+std::vector<std::string> keys(std::size_t n) {
+    std::vector<std::string> k;
+    k.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        k.push_back("key" + std::to_string(i));
+    }
+    return k;
+}
+
+// Text of a typical value of each alternative
+template <typename T> std::string sample();
+template <> std::string sample<int>() {
+    return "12345";
+}
+template <> std::string sample<double>() {
+    return "3.14159";
+}
+template <> std::string sample<std::string>() {
+    return "hello";
+}
+
+template <typename T> void basicCreate(benchmark::State& state) {
+    RepeatedStream in(sample<T>() + " ");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(B::create<T>(in.next()));
+    }
+}
+BENCHMARK_TEMPLATE(basicCreate, int);
+BENCHMARK_TEMPLATE(basicCreate, double);
+BENCHMARK_TEMPLATE(basicCreate, std::string);
+
+void basicCreateByName(benchmark::State& state) {
+    RepeatedStream in("12345 ");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(B::create("int", in.next()));
+    }
+}
+BENCHMARK(basicCreateByName);
+
+void compoundCreate(benchmark::State& state, const CompoundType& type) {
+    RepeatedStream in(
+        type.name() == "multiType" ? multiRecord : nestedRecord);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            CompoundInstance<BR>(type.name(), in.next()));
+    }
+}
+BENCHMARK_CAPTURE(compoundCreate, flat, multiType);
+BENCHMARK_CAPTURE(compoundCreate, nested, nestedType);
+
+void flatCreate(benchmark::State& state) {
+    RepeatedStream in(nestedRecord);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(FlatInstance<BR>("nestedType", in.next()));
+    }
+}
+BENCHMARK(flatCreate);
+
+void batchCreate(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 1024; ++i) {
+        text += nestedRecord;
+    }
+    for (auto _ : state) {
+        TextScanner s(text);
+        benchmark::DoNotOptimize(nestedType.createBatch<BR>(s, 1024));
+    }
+    state.SetItemsProcessed(state.iterations() * 1024);
+}
+BENCHMARK(batchCreate);
+
+void columnScan(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 1024; ++i) {
+        text += nestedRecord;
+    }
+    TextScanner s(text);
+    ColumnBatch<BR> columns("nestedType");
+    columns.read(s);
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto d : columns.column<double>("m.d")) {
+            sum += d;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * 1024);
+}
+BENCHMARK(columnScan);
+
+// Decode a file of records through a stream or a mapping of it
+void fileCreate(benchmark::State& state, bool mapped) {
+    const std::string path = "bench_records.txt";
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 65536; ++i) {
+            out << nestedRecord << "\n";
+        }
+    }
+    for (auto _ : state) {
+        if (mapped) {
+            MappedFile file(path);
+            TextScanner s(file.view());
+            benchmark::DoNotOptimize(nestedType.createBatch<BR>(s, 65536));
+        } else {
+            std::ifstream in(path);
+            benchmark::DoNotOptimize(nestedType.createBatch<BR>(in, 65536));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 65536);
+    std::remove(path.c_str());
+}
+BENCHMARK_CAPTURE(fileCreate, stream, false);
+BENCHMARK_CAPTURE(fileCreate, mapped, true);
+
+// Decode records arriving in chunks of the given size
+void parserFeed(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 1024; ++i) {
+        text += nestedRecord;
+    }
+    auto size = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state) {
+        RecordParser<BR> parser("nestedType");
+        for (std::size_t pos = 0; pos < text.size(); pos += size) {
+            parser.feed(std::string_view(text).substr(pos, size));
+            while (parser.available() > 0) {
+                benchmark::DoNotOptimize(parser.pop());
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 1024);
+}
+BENCHMARK(parserFeed)->Arg(64)->Arg(4096);
+
+void parallelDecode(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 65536; ++i) {
+        text += nestedRecord;
+    }
+    auto threads = static_cast<unsigned>(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            decodeParallel<BR>("nestedType", text, threads));
+    }
+    state.SetItemsProcessed(state.iterations() * 65536);
+}
+BENCHMARK(parallelDecode)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+
+void compoundCreateScanned(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 1024; ++i) {
+        text += nestedRecord;
+    }
+    TextScanner s(text);
+    int remaining = 1024;
+    for (auto _ : state) {
+        if (remaining-- == 0) {
+            s = TextScanner(text);
+            remaining = 1023;
+        }
+        benchmark::DoNotOptimize(CompoundInstance<BR>("nestedType", s));
+    }
+}
+BENCHMARK(compoundCreateScanned);
+
+void scanTokens(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 65536; ++i) {
+        text += nestedRecord;
+        text += i % 4 == 0 ? "\n" : "  ";
+    }
+    for (auto _ : state) {
+        TextScanner s(text);
+        std::size_t count = 0;
+        while (!s.next().empty()) {
+            ++count;
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(scanTokens);
+
+template <typename T> void scanNumbers(benchmark::State& state) {
+    std::string text;
+    for (int i = 0; i < 65536; ++i) {
+        text += std::to_string(static_cast<T>(i * 7919 % 100000) / 8) + " ";
+    }
+    for (auto _ : state) {
+        TextScanner s(text);
+        T x;
+        for (int i = 0; i < 65536; ++i) {
+            detail::scan(s, x);
+            benchmark::DoNotOptimize(x);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 65536);
+}
+BENCHMARK_TEMPLATE(scanNumbers, int);
+BENCHMARK_TEMPLATE(scanNumbers, double);
+
+void compoundGetByName(benchmark::State& state) {
+    std::stringstream in(nestedRecord);
+    CompoundInstance<BR> x("nestedType", in);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x.get<int>("i"));
+        benchmark::DoNotOptimize(x.get("m").get<double>("d"));
+    }
+}
+BENCHMARK(compoundGetByName);
+
+void compoundGetByHandle(benchmark::State& state) {
+    std::stringstream in(nestedRecord);
+    CompoundInstance<BR> x("nestedType", in);
+    const auto& type = BR::resolveCompound("nestedType");
+    auto i = type.field<BR, int>("i");
+    auto md = type.field<BR, double>("m.d");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x.get(i));
+        benchmark::DoNotOptimize(x.get(md));
+    }
+}
+BENCHMARK(compoundGetByHandle);
+
+void compoundCopy(benchmark::State& state) {
+    std::stringstream in(nestedRecord);
+    CompoundInstance<BR> x("nestedType", in);
+    for (auto _ : state) {
+        CompoundInstance<BR> copy(x);
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK(compoundCopy);
+
+void compoundWrite(benchmark::State& state) {
+    std::stringstream in(nestedRecord);
+    CompoundInstance<BR> x("nestedType", in);
+    std::ostringstream out;
+    for (auto _ : state) {
+        out.seekp(0);
+        x.write(out);
+    }
+}
+BENCHMARK(compoundWrite);
+
+template <typename Map> void mapInsert(benchmark::State& state) {
+    auto k = keys(state.range(0));
+    for (auto _ : state) {
+        Map m;
+        for (std::size_t i = 0; i < k.size(); ++i) {
+            m.emplace(k[i], static_cast<int>(i));
+        }
+        benchmark::DoNotOptimize(m);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(
+    mapInsert, StringIntMap)->RangeMultiplier(10)->Range(1, 1000000);
+BENCHMARK_TEMPLATE(
+    mapInsert, CompactStringIntMap)->RangeMultiplier(10)->Range(1, 1000000);
+
+template <typename Map> void mapLookup(benchmark::State& state) {
+    auto k = keys(state.range(0));
+    Map m;
+    for (std::size_t i = 0; i < k.size(); ++i) {
+        m.emplace(k[i], static_cast<int>(i));
+    }
+    for (auto _ : state) {
+        for (const auto& key : k) {
+            benchmark::DoNotOptimize(m.at(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(
+    mapLookup, StringIntMap)->RangeMultiplier(10)->Range(1, 1000000);
+BENCHMARK_TEMPLATE(
+    mapLookup, CompactStringIntMap)->RangeMultiplier(10)->Range(1, 1000000);
+
+template <typename Map> void mapIterate(benchmark::State& state) {
+    auto k = keys(state.range(0));
+    Map m;
+    for (std::size_t i = 0; i < k.size(); ++i) {
+        m.emplace(k[i], static_cast<int>(i));
+    }
+    for (auto _ : state) {
+        int sum = 0;
+        for (const auto& p : m) {
+            sum += p.second;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(
+    mapIterate, StringIntMap)->RangeMultiplier(10)->Range(1, 1000000);
+BENCHMARK_TEMPLATE(
+    mapIterate, CompactStringIntMap)->RangeMultiplier(10)->Range(1, 1000000);
+
+} // namespace
+
+int main(int argc, char** argv) {
+    registerTypes();
+    // Default to JSON output, which any --benchmark_format given on the
+    // command line overrides since later flags take precedence
+    std::vector<char*> args(argv, argv + argc);
+    std::string json = "--benchmark_format=json";
+    args.insert(std::begin(args) + 1, json.data());
+    int count = static_cast<int>(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -3,36 +3,856 @@
 #define RUNTYPE_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <future>
 #include <istream>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
 #include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#if __has_include(<sys/mman.h>)
+#define RUNTYPE_HAS_MMAP 1
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RUNTYPE_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
 namespace runtype {
 
+namespace detail {
+
+// Value type of a TypeMap_t, naming the alternative of the Basic T that
+// the type corresponds to. Construction dispatches through T's static
+// table of function pointers rather than a type-erased callable.
+template <typename T> struct TypeMapEntry {
+    std::size_t index;
+
+    T operator()(std::istream& is) const {
+        return T::create(index, is);
+    }
+};
+
+} // namespace detail
+
 template <typename T>
-using TypeMap_t =
-    std::unordered_map<std::string, std::function<T(std::istream&)>>;
+using TypeMap_t = std::unordered_map<std::string, detail::TypeMapEntry<T>>;
 
 template <typename R, typename... U> class Basic;
 
 namespace detail {
 
+// Whitespace of the C locale: space, \t, \n, \v, \f and \r
+constexpr bool isSpace(unsigned char c) noexcept {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Bit i of the result is set if p[i] is whitespace, for the 64 bytes
+// from p
+using SpaceMaskFn = std::uint64_t (*)(const char* p);
+
+inline std::uint64_t spaceMaskScalar(const char* p) {
+    std::uint64_t mask = 0;
+    for (int i = 0; i < 64; ++i) {
+        if (isSpace(static_cast<unsigned char>(p[i]))) {
+            mask |= std::uint64_t(1) << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef RUNTYPE_X86_DISPATCH
+// '\t' to '\r' are the bytes that are at most 4 after subtracting '\t'
+// with wraparound, which an unsigned minimum can test
+__attribute__((target("sse2"))) inline std::uint64_t spaceMaskSse2(
+    const char* p) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    std::uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+        __m128i x = _mm_sub_epi8(v, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+            _mm_cmpeq_epi8(_mm_min_epu8(x, four), x));
+        auto bits = static_cast<std::uint32_t>(_mm_movemask_epi8(ws));
+        mask |= std::uint64_t(bits) << (16 * i);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) inline std::uint64_t spaceMaskAvx2(
+    const char* p) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    std::uint64_t mask = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p + 32 * i));
+        __m256i x = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(x, four), x));
+        auto bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(ws));
+        mask |= std::uint64_t(bits) << (32 * i);
+    }
+    return mask;
+}
+#endif
+
+// The fastest kernel the running CPU supports
+inline SpaceMaskFn selectSpaceMask() noexcept {
+#ifdef RUNTYPE_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &spaceMaskAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &spaceMaskSse2;
+    }
+#endif
+    return &spaceMaskScalar;
+}
+
+// Whitespace mask of the up to 64 bytes in [p, last). Bytes at or past
+// last count as whitespace, so that tokens end there.
+inline std::uint64_t spaceMask(const char* p, const char* last) noexcept {
+    static const SpaceMaskFn kernel = selectSpaceMask();
+    if (last - p >= 64) {
+        return kernel(p);
+    }
+    std::array<char, 64> padded;
+    padded.fill(' ');
+    if (p != last) {
+        std::memcpy(padded.data(), p, last - p);
+    }
+    return kernel(padded.data());
+}
+
+inline int countTrailingZeros(std::uint64_t x) noexcept {
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    for (; (x & 1) == 0; x >>= 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+inline int countOnes(std::uint64_t x) noexcept {
+#ifdef __GNUC__
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    for (; x != 0; x &= x - 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// Number of whitespace-delimited tokens starting in [first, last), where
+// a token starts at a non-space byte that follows a space or first
+inline std::size_t countTokens(const char* first, const char* last) {
+    std::size_t count = 0;
+    // Whether the byte before the block is a space
+    std::uint64_t carry = 1;
+    for (const char* p = first; p < last; p += 64) {
+        auto spaces = spaceMask(p, last);
+        count += countOnes(~spaces & ((spaces << 1) | carry));
+        carry = spaces >> 63;
+    }
+    return count;
+}
+
+} // namespace detail
+
+// Reads whitespace-delimited values directly from a character range, as
+// a faster alternative to reading from a std::istream. Numbers are
+// parsed with std::from_chars and strings are copied straight out of
+// the input, avoiding the locale and sentry overhead of operator>>. The
+// range must outlive the scanner.
+//
+// Token boundaries are found from a bitmask of the whitespace in each
+// 64-byte block of input, computed with AVX2 or SSE2 where the CPU
+// supports it, so skipping whitespace or finding the end of a token is a
+// shift and a count of trailing zeros rather than a loop over bytes.
+// Whitespace is that of the C locale.
+class TextScanner {
+    const char* pos_;
+    const char* end_;
+    // Whitespace mask of the 64 bytes from block_
+    const char* block_;
+    std::uint64_t spaces_;
+    bool fail_ = false;
+
+    // Bits of the mask from pos_ onwards, moving to the block starting
+    // at pos_ if it has left the current one. Bit 0 is pos_ and the
+    // number of valid bits is returned through n.
+    std::uint64_t spacesFromPos(std::size_t& n) noexcept {
+        auto offset = static_cast<std::size_t>(pos_ - block_);
+        if (offset >= 64) {
+            block_ = pos_;
+            spaces_ = detail::spaceMask(pos_, end_);
+            offset = 0;
+        }
+        n = 64 - offset;
+        return spaces_ >> offset;
+    }
+
+public:
+    TextScanner(const char* first, const char* last)
+        : pos_(first), end_(last), block_(first),
+          spaces_(detail::spaceMask(first, last)) {
+    }
+
+    explicit TextScanner(std::string_view text)
+        : TextScanner(text.data(), text.data() + text.size()) {
+    }
+
+    // Skip any whitespace before the next value
+    void skipWhitespace() noexcept {
+        while (pos_ != end_) {
+            std::size_t n;
+            auto words = ~spacesFromPos(n);
+            if (n < 64) {
+                words &= (std::uint64_t(1) << n) - 1;
+            }
+            if (words != 0) {
+                pos_ += detail::countTrailingZeros(words);
+                return;
+            }
+            pos_ = std::min(pos_ + n, end_);
+        }
+    }
+
+    // Skip whitespace and return the next whitespace-delimited token,
+    // which is empty at the end of the input
+    std::string_view next() noexcept {
+        skipWhitespace();
+        const char* first = pos_;
+        while (pos_ != end_) {
+            std::size_t n;
+            auto spaces = spacesFromPos(n);
+            if (spaces != 0) {
+                // Bytes past the end are whitespace, so this stops there
+                pos_ += detail::countTrailingZeros(spaces);
+                break;
+            }
+            pos_ += n;
+        }
+        return std::string_view(first, pos_ - first);
+    }
+
+    // Unconsumed input
+    std::string_view remaining() const noexcept {
+        return std::string_view(pos_, end_ - pos_);
+    }
+
+    void advance(std::size_t n) noexcept {
+        pos_ += n;
+    }
+
+    // True if a value could not be parsed, like std::istream::fail
+    bool fail() const noexcept {
+        return fail_;
+    }
+
+    void setFail() noexcept {
+        fail_ = true;
+    }
+
+    explicit operator bool() const noexcept {
+        return !fail_;
+    }
+};
+
+// Read-only contents of a whole file, mapped into memory where the
+// platform has mmap so that a TextScanner over view() decodes straight
+// from the page cache without read() copying through a stream buffer.
+// Elsewhere the file is read into memory once.
+class MappedFile {
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+#ifndef RUNTYPE_HAS_MMAP
+    std::vector<char> buffer_;
+#endif
+
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef RUNTYPE_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(
+                errno, std::generic_category(), "Cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(
+                error, std::generic_category(), "Cannot stat " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        // Mapping nothing is an error, but an empty file is not
+        if (size_ != 0) {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(
+                    error, std::generic_category(), "Cannot map " + path);
+            }
+            // Hints only, so failure does not matter
+#ifdef MADV_SEQUENTIAL
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+            ::madvise(p, size_, MADV_WILLNEED);
+#endif
+            data_ = static_cast<const char*>(p);
+        }
+        // The mapping outlives the descriptor
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        buffer_.assign(std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef RUNTYPE_HAS_MMAP
+        if (data_) {
+            ::munmap(const_cast<char*>(data_), size_); // NOLINT
+        }
+#endif
+    }
+
+    const char* data() const noexcept {
+        return data_;
+    }
+
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    std::string_view view() const noexcept {
+        return std::string_view(data_, size_);
+    }
+};
+
+// Tag selecting the binary wire format in place of the text one. Scalars
+// are fixed-width little-endian, strings are prefixed by their length as
+// a 64-bit integer, and compounds are their members in order with no
+// separators.
+struct BinaryFormat {};
+inline constexpr BinaryFormat binary{};
+
+namespace detail {
+
+// Read-only stream buffer over a character range, used to fall back to
+// operator>> without copying the input
+class ViewStreambuf : public std::streambuf {
+public:
+    ViewStreambuf(const char* first, const char* last) {
+        // The get area is never written through
+        auto* p = const_cast<char*>(first); // NOLINT
+        setg(p, p, const_cast<char*>(last)); // NOLINT
+    }
+
+    std::size_t consumed() const {
+        return gptr() - eback();
+    }
+};
+
+template <typename T>
+constexpr bool isCharacter = std::is_same_v<T, char> ||
+                             std::is_same_v<T, signed char> ||
+                             std::is_same_v<T, unsigned char>;
+
+// Whether the text format of a T is always exactly one whitespace-
+// delimited token, as it is for numbers and strings
+template <typename T>
+constexpr bool isSingleToken =
+    (std::is_arithmetic_v<T> && !isCharacter<T>) ||
+    std::is_same_v<T, std::string>;
+
+// Fast paths for the common shapes of numbers, each returning the end of
+// what it parsed, or nullptr to leave the input to std::from_chars. They
+// produce exactly what from_chars would whenever they do not decline.
+
+// True if all 8 bytes of a little-endian word are ASCII digits
+constexpr bool isEightDigits(std::uint64_t v) noexcept {
+    return ((v & 0xF0F0F0F0F0F0F0F0) |
+               (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+           0x3333333333333333;
+}
+
+// Value of 8 digits in a little-endian word, combining pairs, then
+// quadruples, then the two halves with three multiplications
+constexpr std::uint32_t parseEightDigits(std::uint64_t v) noexcept {
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+            (((v >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >>
+        32;
+    return static_cast<std::uint32_t>(v);
+}
+
+// Accumulate the digits from p into m, eight at a time where possible,
+// returning how many there were. m is only meaningful for up to 19.
+inline int parseDigits(
+    const char*& p, const char* last, std::uint64_t& m) noexcept {
+    const char* first = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (last - p >= 8) {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        if (!isEightDigits(v)) {
+            break;
+        }
+        m = m * 100000000 + parseEightDigits(v);
+        p += 8;
+    }
+#endif
+    while (p != last && static_cast<unsigned char>(*p - '0') < 10) {
+        m = m * 10 + static_cast<unsigned char>(*p - '0');
+        ++p;
+    }
+    return static_cast<int>(p - first);
+}
+
+template <typename T>
+const char* parseInteger(const char* first, const char* last, T& x) {
+    const char* p = first;
+    bool negative = std::is_signed_v<T> && p != last && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    std::uint64_t m = 0;
+    int digits = parseDigits(p, last, m);
+    if (digits == 0 || digits > 19) {
+        return nullptr;
+    }
+    using U = std::make_unsigned_t<T>;
+    auto limit = static_cast<std::uint64_t>(std::numeric_limits<T>::max());
+    if (m > limit + (negative ? 1 : 0)) {
+        return nullptr;
+    }
+    // Negating in the unsigned type is well-defined, and converting the
+    // result back is modular from C++20 and on every compiler before
+    x = static_cast<T>(
+        negative ? U(0) - static_cast<U>(m) : static_cast<U>(m));
+    return p;
+}
+
+// Clinger's fast path: when the digits fit exactly in the significand
+// and the power of ten is exact too, one correctly rounded operation
+// gives the correctly rounded result. That needs arithmetic done in the
+// precision of the type, which x87 does not guarantee.
+constexpr bool exactFloatArithmetic = FLT_EVAL_METHOD == 0;
+
+template <typename T>
+const char* parseFloat(const char* first, const char* last, T& x) {
+    static_assert(std::numeric_limits<T>::is_iec559);
+    constexpr int maxExponent = std::is_same_v<T, float> ? 10 : 22;
+    constexpr std::uint64_t maxMantissa = std::uint64_t(1)
+                                          << std::numeric_limits<T>::digits;
+    constexpr T powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+        1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+        1e20, 1e21, 1e22};
+
+    const char* p = first;
+    bool negative = p != last && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    std::uint64_t m = 0;
+    int digits = parseDigits(p, last, m);
+    int exponent = 0;
+    if (p != last && *p == '.') {
+        ++p;
+        int fraction = parseDigits(p, last, m);
+        digits += fraction;
+        exponent = -fraction;
+    }
+    if (digits == 0 || digits > 19) {
+        return nullptr;
+    }
+    if (p != last && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = q != last && *q == '-';
+        if (q != last && (*q == '-' || *q == '+')) {
+            ++q;
+        }
+        std::uint64_t e = 0;
+        int exponentDigits = parseDigits(q, last, e);
+        // A marker without digits is not part of the number
+        if (exponentDigits == 0 || exponentDigits > 4) {
+            return nullptr;
+        }
+        exponent += negativeExponent ? -static_cast<int>(e)
+                                     : static_cast<int>(e);
+        p = q;
+    }
+    if (m > maxMantissa || exponent < -maxExponent ||
+        exponent > maxExponent) {
+        return nullptr;
+    }
+    T value = static_cast<T>(m);
+    value = exponent < 0 ? value / powers[-exponent]
+                         : value * powers[exponent];
+    x = negative ? -value : value;
+    return p;
+}
+
+// Position of the next character to be read, to tell whether a read
+// consumed anything, or -1 if the stream cannot seek. A TextScanner
+// counts back from the end of its input.
+inline std::streamoff readPosition(std::istream& is) {
+    if (!is.rdbuf()) {
+        return -1;
+    }
+    return is.rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+}
+
+inline std::streamoff readPosition(const TextScanner& s) {
+    return -static_cast<std::streamoff>(s.remaining().size());
+}
+
+// Read a T from a TextScanner, matching what operator>> would read from
+// a stream containing the same characters. Arithmetic types use
+// std::from_chars, std::string takes the next token, and everything else
+// goes through operator>> on a stream over the remaining input.
+template <typename T> void scan(TextScanner& s, T& x) {
+    s.skipWhitespace();
+    auto in = s.remaining();
+    if constexpr ((std::is_integral_v<T> || std::is_floating_point_v<T>)&&!(
+                      std::is_same_v<T, bool> || isCharacter<T>)) {
+        const char* first = in.data();
+        const char* last = first + in.size();
+        // operator>> accepts an explicit positive sign, from_chars does not
+        if (first != last && *first == '+') {
+            ++first;
+        }
+        const char* end = nullptr;
+        if constexpr (std::is_integral_v<T>) {
+            end = parseInteger(first, last, x);
+        } else if constexpr (exactFloatArithmetic &&
+                             (std::is_same_v<T, float> ||
+                                 std::is_same_v<T, double>)) {
+            end = parseFloat(first, last, x);
+        }
+        if (end) {
+            s.advance(end - in.data());
+            return;
+        }
+        auto[ptr, ec] = std::from_chars(first, last, x);
+        if (ec != std::errc()) {
+            x = T();
+            s.setFail();
+            return;
+        }
+        s.advance(ptr - in.data());
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        auto token = s.next();
+        if (token.empty()) {
+            s.setFail();
+        }
+        x.assign(token.data(), token.size());
+    } else {
+        ViewStreambuf buf(in.data(), in.data() + in.size());
+        std::istream is(&buf);
+        is >> x;
+        if (is.fail()) {
+            s.setFail();
+        }
+        s.advance(buf.consumed());
+    }
+}
+
+template <typename UInt> void writeLittleEndian(std::ostream& os, UInt x) {
+    std::array<char, sizeof(UInt)> buf{};
+    for (std::size_t i = 0; i < sizeof(UInt); ++i) {
+        buf[i] = static_cast<char>((x >> (8 * i)) & 0xff);
+    }
+    os.write(buf.data(), buf.size());
+}
+
+template <typename UInt> void readLittleEndian(std::istream& is, UInt& x) {
+    std::array<char, sizeof(UInt)> buf{};
+    if (!is.read(buf.data(), buf.size())) {
+        return;
+    }
+    x = 0;
+    for (std::size_t i = 0; i < sizeof(UInt); ++i) {
+        x |= static_cast<UInt>(static_cast<unsigned char>(buf[i])) << (8 * i);
+    }
+}
+
+// Unsigned integer with the same representation as the floating point
+// type T, or void if T has no portable fixed-width encoding
+template <typename T>
+using FloatBits = std::conditional_t<std::numeric_limits<T>::is_iec559 &&
+                                         sizeof(T) == sizeof(std::uint32_t),
+    std::uint32_t,
+    std::conditional_t<std::numeric_limits<T>::is_iec559 &&
+                           sizeof(T) == sizeof(std::uint64_t),
+        std::uint64_t,
+        void>>;
+
+inline void writeBinaryString(std::ostream& os, std::string_view x) {
+    writeLittleEndian<std::uint64_t>(os, x.size());
+    os.write(x.data(), x.size());
+}
+
+inline void readBinaryString(std::istream& is, std::string& x) {
+    std::uint64_t size = 0;
+    readLittleEndian(is, size);
+    if (!is) {
+        return;
+    }
+    // Grow the string only as data arrives, so that a corrupt length
+    // fails the stream instead of allocating it all up front
+    constexpr std::uint64_t chunk = 64 * 1024;
+    x.clear();
+    while (size > 0) {
+        auto n = static_cast<std::size_t>(std::min(size, chunk));
+        auto old = x.size();
+        x.resize(old + n);
+        if (!is.read(x.data() + old, n)) {
+            x.resize(old + static_cast<std::size_t>(is.gcount()));
+            return;
+        }
+        size -= n;
+    }
+}
+
+template <typename T> void writeBinary(std::ostream& os, const T& x) {
+    if constexpr (std::is_same_v<T, bool>) {
+        os.put(x ? 1 : 0);
+    } else if constexpr (std::is_integral_v<T>) {
+        writeLittleEndian(os, static_cast<std::make_unsigned_t<T>>(x));
+    } else if constexpr (std::is_floating_point_v<T> &&
+                         !std::is_void_v<FloatBits<T>>) {
+        FloatBits<T> bits;
+        std::memcpy(&bits, &x, sizeof(T));
+        writeLittleEndian(os, bits);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        writeBinaryString(os, x);
+    } else {
+        // No fixed encoding, so store the text representation
+        std::ostringstream text;
+        text << x;
+        writeBinaryString(os, text.str());
+    }
+}
+
+template <typename T> void readBinary(std::istream& is, T& x) {
+    if constexpr (std::is_same_v<T, bool>) {
+        char c = 0;
+        if (is.get(c)) {
+            x = c != 0;
+        }
+    } else if constexpr (std::is_integral_v<T>) {
+        std::make_unsigned_t<T> bits = 0;
+        readLittleEndian(is, bits);
+        x = static_cast<T>(bits);
+    } else if constexpr (std::is_floating_point_v<T> &&
+                         !std::is_void_v<FloatBits<T>>) {
+        FloatBits<T> bits = 0;
+        readLittleEndian(is, bits);
+        std::memcpy(&x, &bits, sizeof(T));
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        readBinaryString(is, x);
+    } else {
+        std::string text;
+        readBinaryString(is, text);
+        std::istringstream textStream(text);
+        textStream >> x;
+    }
+}
+
+} // namespace detail
+
+namespace detail {
+
 // Used to pass parameter packs as arguments to help type deduction
 template <typename... U> struct Pack {};
 
+// Index of T in the parameter pack U...
+template <typename T, typename... U> struct IndexOf;
+
+template <typename T, typename... Rest>
+struct IndexOf<T, T, Rest...> : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename First, typename... Rest>
+struct IndexOf<T, First, Rest...>
+    : std::integral_constant<std::size_t, 1 + IndexOf<T, Rest...>::value> {};
+
+// Operations on a T living in raw storage, so that they can be stored
+// as plain function pointers and selected with a runtime index
+template <typename T> void constructAt(void* p) {
+    ::new (p) T();
+}
+
+template <typename T> void destroyAt(void* p) {
+    std::launder(static_cast<T*>(p))->~T();
+}
+
+template <typename T> void copyConstructAt(void* p, const void* rhs) {
+    ::new (p) T(*std::launder(static_cast<const T*>(rhs)));
+}
+
+// Move construct at p from the object at rhs, then destroy that object
+template <typename T> void relocateAt(void* p, void* rhs) {
+    auto* from = std::launder(static_cast<T*>(rhs));
+    ::new (p) T(std::move(*from));
+    from->~T();
+}
+
+template <typename T> void readAt(std::istream& is, void* p) {
+    is >> *std::launder(static_cast<T*>(p));
+}
+
+template <typename T> void writeAt(std::ostream& os, const void* p) {
+    os << *std::launder(static_cast<const T*>(p));
+}
+
+template <typename T> void scanAt(TextScanner& s, void* p) {
+    scan(s, *std::launder(static_cast<T*>(p)));
+}
+
+template <typename T> void readBinaryAt(std::istream& is, void* p) {
+    readBinary(is, *std::launder(static_cast<T*>(p)));
+}
+
+template <typename T> void writeBinaryAt(std::ostream& os, const void* p) {
+    writeBinary(os, *std::launder(static_cast<const T*>(p)));
+}
+
+// Type-erased description of the alternatives of a Basic, indexed by
+// the position of the alternative in U...
+template <typename... U> struct Alternatives {
+    static constexpr std::size_t count = sizeof...(U);
+    static constexpr std::array<std::size_t, count> size = {sizeof(U)...};
+    static constexpr std::array<std::size_t, count> alignment = {
+        alignof(U)...};
+    static constexpr std::array<void (*)(void*), count> construct = {
+        &constructAt<U>...};
+    static constexpr std::array<void (*)(void*), count> destroy = {
+        &destroyAt<U>...};
+    static constexpr std::array<void (*)(void*, const void*), count> copy = {
+        &copyConstructAt<U>...};
+    static constexpr std::array<void (*)(void*, void*), count> relocate = {
+        &relocateAt<U>...};
+    static constexpr std::array<void (*)(std::istream&, void*), count> read =
+        {&readAt<U>...};
+    static constexpr std::array<void (*)(std::ostream&, const void*), count>
+        write = {&writeAt<U>...};
+    static constexpr std::array<void (*)(TextScanner&, void*), count> scan = {
+        &scanAt<U>...};
+    static constexpr std::array<void (*)(std::istream&, void*), count>
+        readBinary = {&readBinaryAt<U>...};
+    static constexpr std::array<void (*)(std::ostream&, const void*), count>
+        writeBinary = {&writeBinaryAt<U>...};
+    static constexpr std::array<bool, count> singleToken = {
+        isSingleToken<U>...};
+};
+
+// Type-erased column of values of one of the alternatives in a Pack
+template <typename P> struct ColumnOf;
+
+template <typename... U> struct ColumnOf<Pack<U...>> {
+    using type = std::variant<std::vector<U>...>;
+
+    // Empty column of the alternative with the given index
+    static type make(std::size_t index) {
+        static constexpr std::array<type (*)(), sizeof...(U)> makers = {
+            []() -> type { return std::vector<U>(); }...};
+        return makers[index]();
+    }
+};
+
+// Round offset up to the next multiple of alignment, which must be a
+// power of two
+constexpr std::size_t alignUp(std::size_t offset, std::size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Frees storage obtained from the aligned operator new
+struct AlignedDelete {
+    std::size_t alignment;
+
+    void operator()(std::byte* p) const {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+};
+
+using AlignedBuffer = std::unique_ptr<std::byte[], AlignedDelete>;
+
+inline AlignedBuffer allocateAligned(
+    std::size_t size, std::size_t alignment) {
+    if (size == 0) {
+        return AlignedBuffer(nullptr, AlignedDelete{alignment});
+    }
+    return AlignedBuffer(static_cast<std::byte*>(::operator new(
+                             size, std::align_val_t(alignment))),
+        AlignedDelete{alignment});
+}
+
 // Add a new type to a TypeMap_t unless the name already exists, in
 // which case do nothing
 template <typename T, typename S>
 constexpr void registerType(TypeMap_t<S>& typeMap, const std::string& name) {
-    typeMap.try_emplace(
-        name, [](std::istream& is) { return S::template create<T>(is); });
+    typeMap.try_emplace(name, TypeMapEntry<S>{S::template indexOf<T>()});
 }
 
 // Base case for makeTypeMap recursion
@@ -61,23 +881,99 @@ inline TypeMap_t<Basic<R, U...>> makeTypeMap(
     return m;
 }
 
+struct ResourceDelete;
+
 // All type variants (Basic, Compound etc) should derive this
 class TypeInstance { // NOLINT (rule of 5 is not needed)
+public:
+    // Which variant the instance is, so that it can be downcast with a
+    // static_cast instead of a dynamic_cast
+    enum class Kind { Basic, Compound, Flat };
+
+private:
+    Kind kind_;
+
+protected:
+    explicit TypeInstance(Kind kind) : kind_(kind) {
+    }
+
 public:
     virtual ~TypeInstance() = default;
+
+    Kind kind() const noexcept {
+        return kind_;
+    }
+
+    // Deep copy allocated from the memory resource
+    virtual std::unique_ptr<TypeInstance, ResourceDelete> clone(
+        std::pmr::memory_resource*) const = 0;
+
     virtual std::ostream& write(std::ostream&) const = 0;
     virtual std::istream& read(std::istream&) = 0;
+    virtual TextScanner& read(TextScanner&) = 0;
+    virtual std::ostream& writeBinary(std::ostream&) const = 0;
+    virtual std::istream& readBinary(std::istream&) = 0;
     virtual const TypeInstance& operator()(
-        const std::string& /*unused*/) const {
+        std::string_view /*unused*/) const {
         throw std::runtime_error("Not a compound type");
     }
 };
 
+// Deleter for a TypeInstance allocated from a memory resource, which
+// needs to know the size and alignment of the most derived type
+struct ResourceDelete {
+    std::pmr::memory_resource* resource = nullptr;
+    std::size_t size = 0;
+    std::size_t alignment = 0;
+
+    void operator()(TypeInstance* p) const {
+        p->~TypeInstance();
+        resource->deallocate(p, size, alignment);
+    }
+};
+
+// Construct a T from a memory resource, which must outlive it
+template <typename T, typename... Args>
+std::unique_ptr<TypeInstance, ResourceDelete> allocateInstance(
+    std::pmr::memory_resource* resource, Args&&... args) {
+    void* p = resource->allocate(sizeof(T), alignof(T));
+    try {
+        ::new (p) T(std::forward<Args>(args)...);
+    } catch (...) {
+        resource->deallocate(p, sizeof(T), alignof(T));
+        throw;
+    }
+    return std::unique_ptr<TypeInstance, ResourceDelete>(
+        static_cast<T*>(p), ResourceDelete{resource, sizeof(T), alignof(T)});
+}
+
+// Whether Hash and KeyEqual both allow heterogeneous lookup
+template <typename Hash, typename KeyEqual, typename = void>
+struct IsTransparent : std::false_type {};
+
+template <typename Hash, typename KeyEqual>
+struct IsTransparent<Hash,
+    KeyEqual,
+    std::void_t<typename Hash::is_transparent,
+        typename KeyEqual::is_transparent>> : std::true_type {};
+
+// Transparent hash of anything convertible to a std::string_view, which
+// agrees with std::hash<std::string>. Used with std::equal_to<> it lets
+// maps keyed by std::string be searched without constructing one.
+struct StringHash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view s) const noexcept {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
 template <typename Key,
     typename T,
     typename Hash,
     typename KeyEqual,
-    typename Allocator>
+    typename Allocator,
+    std::size_t N>
 class OrderPreservingMap;
 
 // Bidirectional iterator class for the OrderPreservingMap.
@@ -88,78 +984,48 @@ template <bool IsConst,
     typename T,
     typename Hash,
     typename KeyEqual,
-    typename Allocator>
+    typename Allocator,
+    std::size_t N>
 class OrderPreservingMapIteratorImpl {
-    friend class OrderPreservingMap<Key, T, Hash, KeyEqual, Allocator>;
-
-    using map_type = std::unordered_map<Key, T, Hash, KeyEqual, Allocator>;
-    using vec_type = std::vector<typename map_type::iterator>;
-    using vec_iterator = typename std::conditional<IsConst,
-        typename vec_type::const_iterator,
-        typename vec_type::iterator>::type;
-    // This should really be const& all the time, since an iterator
-    // cannot modify the order. However, std::begin(order_)
-    // will always return a const_iterator if order_ is const&.
-    // This makes the O(n) constructor awkward, requiring
-    // const_casts or preventing the use of std::find (no conversion
-    // from the returned const_iterator to an iterator even with
-    // const_cast; const_iterator != const iterator.
-    // PRs welcome.
-    using order_type =
-        typename std::conditional<IsConst, const vec_type&, vec_type&>::type;
+    using map_type = OrderPreservingMap<Key, T, Hash, KeyEqual, Allocator, N>;
+    friend map_type;
+
+    using map_pointer =
+        typename std::conditional<IsConst, const map_type*, map_type*>::type;
 
     // The ordering is kept by the underlying map not the iterator;
     // each iterator needs to be bound to a map which provides the
     // ordering used -- and ++ etc
-    order_type order_;
-    vec_iterator it_;
+    map_pointer map_;
+    std::size_t pos_;
 
-    // O(1) creation at the given point in the ordering.
-    constexpr OrderPreservingMapIteratorImpl(order_type order, vec_iterator it)
-        : order_(order), it_(it) {
+    // O(1) creation at the given point in the ordering
+    constexpr OrderPreservingMapIteratorImpl(map_pointer map, std::size_t pos)
+        : map_(map), pos_(pos) {
     }
 
 public:
     using difference_type = std::ptrdiff_t;
     using value_type = typename std::conditional<IsConst,
-        const typename map_type::value_type,
-        typename map_type::value_type>::type;
-    using pointer = typename std::conditional<IsConst,
-        typename map_type::const_pointer,
-        typename map_type::pointer>::type;
-    using reference = typename std::conditional<IsConst,
-        typename map_type::const_reference,
-        typename map_type::reference>::type;
+        const std::pair<const Key, T>,
+        std::pair<const Key, T>>::type;
+    using pointer = value_type*;
+    using reference = value_type&;
     using iterator_category = std::bidirectional_iterator_tag;
 
-    // O(n) creation using a map iterator, e.g. if the key is known
-    constexpr OrderPreservingMapIteratorImpl(
-        order_type order, const typename map_type::iterator& it)
-        : order_(order) {
-        it_ = std::find(std::begin(order_), std::end(order_), it);
-    }
-
-    constexpr reference operator*() {
-        // it_ is an iterator to an iterator
-        return **it_;
-    }
-
     constexpr reference operator*() const {
-        return **it_;
+        return *map_->slot(pos_);
     }
 
-    constexpr typename map_type::iterator operator->() {
-        // Pass through to the map iterator's -> operator to get
-        // member access for free
-        return *it_;
-    }
-
-    constexpr typename map_type::iterator operator->() const {
-        return *it_;
+    constexpr pointer operator->() const {
+        return &*map_->slot(pos_);
     }
 
+    // Tombstones are skipped over in both directions
     constexpr OrderPreservingMapIteratorImpl& operator++() {
-        ++it_;
+        do {
+            ++pos_;
+        } while (pos_ < map_->slot_count() && !map_->slot(pos_));
         return *this;
     }
 
@@ -170,7 +1036,9 @@ public:
     }
 
     constexpr OrderPreservingMapIteratorImpl& operator--() {
-        --it_;
+        do {
+            --pos_;
+        } while (!map_->slot(pos_));
         return *this;
     }
 
@@ -181,7 +1049,7 @@ public:
     }
 
     constexpr bool operator==(const OrderPreservingMapIteratorImpl& rhs) {
-        return it_ == rhs.it_;
+        return pos_ == rhs.pos_;
     }
 
     constexpr bool operator!=(const OrderPreservingMapIteratorImpl& rhs) {
@@ -193,17 +1061,19 @@ template <typename Key,
     typename T,
     typename Hash,
     typename KeyEqual,
-    typename Allocator>
+    typename Allocator,
+    std::size_t N>
 using OrderPreservingMapIterator =
-    OrderPreservingMapIteratorImpl<false, Key, T, Hash, KeyEqual, Allocator>;
+    OrderPreservingMapIteratorImpl<false, Key, T, Hash, KeyEqual, Allocator, N>;
 
 template <typename Key,
     typename T,
     typename Hash,
     typename KeyEqual,
-    typename Allocator>
+    typename Allocator,
+    std::size_t N>
 using OrderPreservingMapConstIterator =
-    OrderPreservingMapIteratorImpl<true, Key, T, Hash, KeyEqual, Allocator>;
+    OrderPreservingMapIteratorImpl<true, Key, T, Hash, KeyEqual, Allocator, N>;
 
 // std::map sorts with < on the key by default, and
 // std::unordered_map is well, unordered, but we need to iterate
@@ -212,24 +1082,56 @@ using OrderPreservingMapConstIterator =
 // handling to the user(!). This abstracts it away by
 // providing an interface matching std::unordered_map with (average)
 // O(1) lookup, but with iteration in insertion order.
+//
+// The first N elements are stored inline and found by a linear scan
+// over their hashes, so small maps do not allocate. Consequently,
+// moving a map invalidates references to those elements, and copies
+// their keys, which are const. The inline slots are paid for even when
+// empty: with the default N an empty map from std::string to int takes
+// 600 bytes, and a CompoundInstance 832 besides its members, so maps
+// that are not created per record use a smaller N.
+//
+// If Hash and KeyEqual are both transparent then, as in C++20, lookups
+// also accept any type they can be called with, without constructing a
+// key_type.
 template <typename Key,
     typename T,
     typename Hash = std::hash<Key>,
     typename KeyEqual = std::equal_to<Key>,
-    typename Allocator = std::allocator<std::pair<const Key, T>>>
+    typename Allocator = std::allocator<std::pair<const Key, T>>,
+    std::size_t N = 8>
 class OrderPreservingMap {
-    using map_type = std::unordered_map<Key, T, Hash, KeyEqual, Allocator>;
-    using vec_type = std::vector<typename map_type::iterator>;
-    using map_iterator = typename map_type::iterator;
-    using const_map_iterator = typename map_type::const_iterator;
+    template <bool, typename, typename, typename, typename, typename,
+        std::size_t>
+    friend class OrderPreservingMapIteratorImpl;
 
-public:
-    using key_type = Key;
-    using mapped_type = T;
-    using value_type = std::pair<const Key, T>;
-    using size_type = typename map_type::size_type;
-    using difference_type = typename map_type::difference_type;
-    using hasher = Hash;
+    template <typename U>
+    using rebind_alloc =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+    using slot_type = std::optional<std::pair<const Key, T>>;
+    using overflow_type = std::deque<slot_type, rebind_alloc<slot_type>>;
+
+    // Entry of the open-addressed index, giving the position of the slot
+    // holding a key with the given hash
+    struct IndexEntry {
+        std::size_t hash;
+        std::size_t pos;
+    };
+
+    using index_type = std::vector<IndexEntry, rebind_alloc<IndexEntry>>;
+
+    template <typename K, typename H = Hash>
+    using enable_transparent = std::enable_if_t<
+        IsTransparent<H, KeyEqual>::value && !std::is_same_v<K, Key>>;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
     using key_equal = KeyEqual;
     using allocator_type = Allocator;
     using reference = value_type&;
@@ -238,30 +1140,315 @@ public:
     using const_pointer =
         typename std::allocator_traits<Allocator>::const_pointer;
     using iterator =
-        OrderPreservingMapIterator<Key, T, Hash, KeyEqual, Allocator>;
+        OrderPreservingMapIterator<Key, T, Hash, KeyEqual, Allocator, N>;
     using const_iterator =
-        OrderPreservingMapConstIterator<Key, T, Hash, KeyEqual, Allocator>;
+        OrderPreservingMapConstIterator<Key, T, Hash, KeyEqual, Allocator, N>;
 
 private:
-    // The iterator at index i points is the (i+1)-th element that
-    // was added, e.g. vec_[0] points to the entry of map_ that was
-    // inserted first.
-    vec_type vec_;
-    map_type map_;
+    static constexpr size_type npos = std::numeric_limits<size_type>::max();
+    // Positions of index entries which have never been used, and of
+    // those whose element has been erased
+    static constexpr size_type emptyPos = npos;
+    static constexpr size_type erasedPos = npos - 1;
+
+    // Slot i holds the (i+1)-th element that was added, or is empty if
+    // that element has been erased. The first N slots are inline_ and
+    // the rest are overflow_, which only exists once there are more
+    // than N slots. While there are at most N slots hashes_ holds the
+    // hash of each inline key, otherwise index_ is a linearly probed
+    // table of the hash and position of every element, at most two
+    // thirds full. Either way a lookup gives a position, so turning it
+    // into an ordered iterator is O(1).
+    std::array<slot_type, N> inline_{};
+    std::array<std::size_t, N> hashes_{};
+    std::optional<overflow_type> overflow_;
+    index_type index_;
+    // Number of inline slots in use
+    size_type used_ = 0;
+    // Number of empty slots
+    size_type dead_ = 0;
+    // Position of the first element
+    size_type head_ = 0;
+    // Number of index entries that are not emptyPos
+    size_type filled_ = 0;
+    hasher hash_;
+    key_equal equal_;
+
+    constexpr size_type slot_count() const noexcept {
+        return used_ + (overflow_ ? overflow_->size() : 0);
+    }
+
+    constexpr slot_type& slot(size_type pos) {
+        return pos < N ? inline_[pos] : (*overflow_)[pos - N];
+    }
+
+    constexpr const slot_type& slot(size_type pos) const {
+        return pos < N ? inline_[pos] : (*overflow_)[pos - N];
+    }
+
+    constexpr size_type mask() const noexcept {
+        return index_.size() - 1;
+    }
+
+    // Construct an element in a new slot at the back
+    template <typename... Args> size_type push_slot(Args&&... args) {
+        reserve_index(slot_count() + 1);
+        if (used_ < N) {
+            inline_[used_].emplace(std::forward<Args>(args)...);
+            return used_++;
+        }
+        if (!overflow_) {
+            overflow_.emplace(get_allocator());
+        }
+        overflow_->emplace_back(std::in_place, std::forward<Args>(args)...);
+        return N + overflow_->size() - 1;
+    }
+
+    // Remove the slot at the back
+    constexpr void pop_slot() {
+        if (overflow_ && !overflow_->empty()) {
+            overflow_->pop_back();
+        } else {
+            inline_[--used_].reset();
+        }
+    }
+
+    // Position of the element with key k and hash h, or npos if there is
+    // none. Only inline slots before end are scanned.
+    template <typename K>
+    constexpr size_type find_pos(
+        const K& k, std::size_t h, size_type end = npos) const {
+        if (index_.empty()) {
+            end = std::min(end, used_);
+            for (size_type i = 0; i < end; ++i) {
+                if (inline_[i] && hashes_[i] == h &&
+                    equal_(inline_[i]->first, k)) {
+                    return i;
+                }
+            }
+            return npos;
+        }
+        for (auto i = h & mask();; i = (i + 1) & mask()) {
+            const auto& e = index_[i];
+            if (e.pos == emptyPos) {
+                return npos;
+            }
+            if (e.pos != erasedPos && e.hash == h &&
+                equal_(slot(e.pos)->first, k)) {
+                return e.pos;
+            }
+        }
+    }
+
+    template <typename K> constexpr size_type find_pos(const K& k) const {
+        return find_pos(k, hash_(k));
+    }
+
+    constexpr T& at_pos(size_type pos) {
+        if (pos == npos) {
+            throw std::out_of_range("OrderPreservingMap::at");
+        }
+        return slot(pos)->second;
+    }
+
+    constexpr const T& at_pos(size_type pos) const {
+        if (pos == npos) {
+            throw std::out_of_range("OrderPreservingMap::at");
+        }
+        return slot(pos)->second;
+    }
+
+    // Index entry for the element at pos, whose key has hash h
+    constexpr IndexEntry& entry_for(std::size_t h, size_type pos) {
+        auto i = h & mask();
+        while (index_[i].pos != pos) {
+            i = (i + 1) & mask();
+        }
+        return index_[i];
+    }
+
+    // Put e in the first unused entry of table for its hash
+    static constexpr size_type place(index_type& table, IndexEntry e) {
+        auto m = table.size() - 1;
+        auto i = e.hash & m;
+        while (table[i].pos < erasedPos) {
+            i = (i + 1) & m;
+        }
+        auto wasEmpty = table[i].pos == emptyPos;
+        table[i] = e;
+        return wasEmpty ? 1 : 0;
+    }
+
+    // Make sure the index can take another entry once there are count
+    // slots, building it from hashes_ if there is no index yet. A rebuilt
+    // index is at most a third full.
+    void reserve_index(size_type count) {
+        if (index_.empty() ? count <= N
+                           : (filled_ + 1) * 3 <= index_.size() * 2) {
+            return;
+        }
+        rebuild_index(capacity_for((size() + 1) * 2));
+    }
+
+    // Smallest index capacity which can hold n entries
+    static constexpr size_type capacity_for(size_type n) {
+        size_type capacity = 16;
+        while (capacity * 2 < n * 3) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    // Replace the index with one of the given capacity, which must be a
+    // power of two large enough for every element
+    void rebuild_index(size_type capacity) {
+        index_type table(
+            capacity, IndexEntry{0, emptyPos}, index_.get_allocator());
+        size_type filled = 0;
+        if (index_.empty()) {
+            for (size_type i = 0; i < used_; ++i) {
+                if (inline_[i]) {
+                    filled += place(table, IndexEntry{hashes_[i], i});
+                }
+            }
+        } else {
+            for (const auto& e : index_) {
+                if (e.pos < erasedPos) {
+                    filled += place(table, e);
+                }
+            }
+        }
+        index_.swap(table);
+        filled_ = filled;
+    }
+
+    // Record the hash h of the element in the slot at the back
+    constexpr void index_back(std::size_t h) {
+        auto pos = slot_count() - 1;
+        if (index_.empty()) {
+            hashes_[pos] = h;
+        } else {
+            filled_ += place(index_, IndexEntry{h, pos});
+        }
+    }
+
+    // Make the element constructed in the slot at the back findable
+    // unless its key is already present, in which case remove it again
+    std::pair<iterator, bool> add_back() {
+        auto pos = slot_count() - 1;
+        size_type existing;
+        std::size_t h;
+        try {
+            h = hash_(slot(pos)->first);
+            existing = find_pos(slot(pos)->first, h, pos);
+        } catch (...) {
+            pop_slot();
+            throw;
+        }
+        if (existing != npos) {
+            pop_slot();
+            return std::make_pair(iterator(this, existing), false);
+        }
+        index_back(h);
+        return std::make_pair(iterator(this, pos), true);
+    }
+
+    // Add a new element with key k, which has hash h and is not already
+    // present
+    template <typename KArg, typename... Args>
+    iterator append(std::size_t h, KArg&& k, Args&&... args) {
+        push_slot(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<KArg>(k)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        index_back(h);
+        return iterator(this, slot_count() - 1);
+    }
+
+    // Position of the first element at or after pos
+    constexpr size_type skip_dead(size_type pos) const {
+        while (pos < slot_count() && !slot(pos)) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    // Move every element down over the empty slots before it, returning
+    // the new position of the element that was at pos
+    size_type compact(size_type pos) {
+        size_type moved = 0;
+        size_type j = 0;
+        try {
+            for (size_type i = 0; i < slot_count(); ++i) {
+                if (i == pos) {
+                    moved = j;
+                }
+                if (!slot(i)) {
+                    continue;
+                }
+                if (i != j) {
+                    slot(j).emplace(std::move(*slot(i)));
+                    if (index_.empty()) {
+                        hashes_[j] = hashes_[i];
+                    } else {
+                        entry_for(hash_(slot(j)->first), i).pos = j;
+                    }
+                    slot(i).reset();
+                }
+                ++j;
+            }
+        } catch (...) {
+            head_ = skip_dead(0);
+            throw;
+        }
+        if (pos >= slot_count()) {
+            moved = j;
+        }
+        if (overflow_) {
+            overflow_->resize(j > N ? j - N : 0);
+        }
+        used_ = std::min(j, N);
+        dead_ = 0;
+        head_ = 0;
+        return moved;
+    }
 
-    // Insert the iterator into the tracker if the bool is true,
-    // otherwise do nothing
-    constexpr inline void track_insert(const std::pair<map_iterator, bool>& p) {
-        auto[it, success] = p;
-        if (success) {
-            vec_.push_back(it);
+    // Empty the slot at pos, returning the position of the element after
+    // it. Once more than half the slots are empty they are compacted
+    // away, so erasing is amortised O(1) and iteration stays O(size()).
+    size_type erase_at(size_type pos) {
+        if (!index_.empty()) {
+            entry_for(hash_(slot(pos)->first), pos).pos = erasedPos;
+        }
+        slot(pos).reset();
+        ++dead_;
+        if (dead_ == slot_count()) {
+            clear();
+            return 0;
+        }
+        while (!slot(slot_count() - 1)) {
+            pop_slot();
+            --dead_;
+        }
+        auto next = skip_dead(std::min(pos, slot_count()));
+        if (pos == head_) {
+            head_ = next;
         }
+        if (dead_ * 2 > slot_count()) {
+            next = compact(next);
+        }
+        return next;
     }
 
-    // Convert an unordered_map iterator/bool pair to an ordered one
-    constexpr inline std::pair<iterator, bool> order_iterator(
-        const std::pair<map_iterator, bool>& p) {
-        return std::make_pair(iterator(vec_, p.first), p.second);
+    // Take the inline elements of rhs into this map, which has already
+    // taken the rest of the state of rhs
+    void take_inline(OrderPreservingMap& rhs) {
+        for (size_type i = 0; i < used_; ++i) {
+            if (rhs.inline_[i]) {
+                inline_[i].emplace(std::move(*rhs.inline_[i]));
+            }
+        }
+        hashes_ = rhs.hashes_;
+        rhs.clear();
     }
 
 public:
@@ -271,7 +1458,8 @@ public:
         const hasher& hash = hasher(),
         const key_equal& equal = key_equal(),
         const allocator_type& alloc = allocator_type())
-        : map_(bucket_count, hash, equal, alloc) {
+        : index_(alloc), hash_(hash), equal_(equal) {
+        (void)bucket_count;
         for (const auto& x : init) {
             emplace(x);
         }
@@ -279,99 +1467,315 @@ public:
 
     constexpr OrderPreservingMap() = default;
 
-    constexpr OrderPreservingMap(const OrderPreservingMap& rhs) {
+    // Any elements which are not stored inline are allocated with alloc
+    constexpr explicit OrderPreservingMap(const allocator_type& alloc)
+        : index_(alloc) {
+    }
+
+    constexpr OrderPreservingMap(const OrderPreservingMap& rhs)
+        : OrderPreservingMap(rhs,
+              std::allocator_traits<allocator_type>::
+                  select_on_container_copy_construction(
+                      rhs.get_allocator())) {
+    }
+
+    // Empty slots in rhs are not copied
+    constexpr OrderPreservingMap(
+        const OrderPreservingMap& rhs, const allocator_type& alloc)
+        : index_(alloc), hash_(rhs.hash_), equal_(rhs.equal_) {
         for (const auto& x : rhs) {
             emplace(x);
         }
     }
 
-    constexpr OrderPreservingMap& operator=(
-        const OrderPreservingMap& /*unused*/) = default;
+    constexpr OrderPreservingMap& operator=(const OrderPreservingMap& rhs) {
+        if (this != &rhs) {
+            clear();
+            for (const auto& x : rhs) {
+                emplace(x);
+            }
+        }
+        return *this;
+    }
 
-    constexpr OrderPreservingMap(
-        OrderPreservingMap&& /*unused*/) noexcept = default;
+    // Inline elements are moved one by one, and do not keep their
+    // addresses
+    constexpr OrderPreservingMap(OrderPreservingMap&& rhs) noexcept
+        : overflow_(std::move(rhs.overflow_)),
+          index_(std::move(rhs.index_)),
+          used_(rhs.used_),
+          dead_(rhs.dead_),
+          head_(rhs.head_),
+          filled_(rhs.filled_),
+          hash_(rhs.hash_),
+          equal_(rhs.equal_) {
+        take_inline(rhs);
+    }
 
-    constexpr OrderPreservingMap& operator=(
-        OrderPreservingMap&& /*unused*/) noexcept = default;
+    constexpr OrderPreservingMap& operator=(OrderPreservingMap&& rhs) noexcept(
+        std::allocator_traits<
+            allocator_type>::propagate_on_container_move_assignment::value ||
+        std::allocator_traits<allocator_type>::is_always_equal::value) {
+        using traits = std::allocator_traits<allocator_type>;
+        if (this == &rhs) {
+            return *this;
+        }
+        clear();
+        hash_ = rhs.hash_;
+        equal_ = rhs.equal_;
+        if (traits::propagate_on_container_move_assignment::value ||
+            get_allocator() == rhs.get_allocator()) {
+            // Swapping rather than move assigning avoids instantiating
+            // element-wise assignment, which const keys do not support
+            overflow_.swap(rhs.overflow_);
+            index_.swap(rhs.index_);
+            used_ = rhs.used_;
+            dead_ = rhs.dead_;
+            head_ = rhs.head_;
+            filled_ = rhs.filled_;
+            take_inline(rhs);
+        } else {
+            for (auto& x : rhs) {
+                emplace(x.first, std::move(x.second));
+            }
+            rhs.clear();
+        }
+        return *this;
+    }
 
     ~OrderPreservingMap() = default;
 
     constexpr iterator begin() {
-        return iterator(vec_, std::begin(vec_));
+        return iterator(this, head_);
     }
 
     constexpr iterator end() {
-        return iterator(vec_, std::end(vec_));
+        return iterator(this, slot_count());
     }
 
     constexpr const_iterator begin() const {
-        return const_iterator(vec_, std::cbegin(vec_));
+        return const_iterator(this, head_);
     }
 
     constexpr const_iterator end() const {
-        return const_iterator(vec_, std::cend(vec_));
+        return const_iterator(this, slot_count());
+    }
+
+    constexpr allocator_type get_allocator() const {
+        return allocator_type(index_.get_allocator());
+    }
+
+    // Iterator to the n-th element in insertion order, in O(1) unless
+    // elements have been erased since the map was last compacted
+    constexpr iterator nth(size_type n) {
+        return dead_ == 0 ? iterator(this, n)
+                          : std::next(begin(), static_cast<difference_type>(n));
+    }
+
+    constexpr const_iterator nth(size_type n) const {
+        return dead_ == 0 ? const_iterator(this, n)
+                          : std::next(begin(), static_cast<difference_type>(n));
     }
 
     constexpr bool empty() const noexcept {
-        return map_.empty();
+        return size() == 0;
     }
 
     constexpr size_type size() const noexcept {
-        return map_.size();
+        return slot_count() - dead_;
     }
 
     constexpr size_type max_size() const noexcept {
-        return map_.max_size();
+        return std::numeric_limits<difference_type>::max() / 2;
+    }
+
+    // Number of entries in the index, which is zero while the elements
+    // are found by scanning the inline slots
+    constexpr size_type bucket_count() const noexcept {
+        return index_.size();
+    }
+
+    constexpr float load_factor() const noexcept {
+        return index_.empty() ? 0.0f
+                              : static_cast<float>(size()) /
+                static_cast<float>(index_.size());
+    }
+
+    // The index is rebuilt before it becomes more than two thirds full
+    constexpr float max_load_factor() const noexcept {
+        return 2.0f / 3.0f;
+    }
+
+    // Rebuild the index with at least count entries, and enough for the
+    // current elements
+    void rehash(size_type count) {
+        if (count == 0 && index_.empty()) {
+            return;
+        }
+        auto capacity = capacity_for(size() + 1);
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        rebuild_index(capacity);
+    }
+
+    // Size the index so that n elements can be added without rebuilding
+    // it. The overflow slots are a std::deque, which never moves its
+    // elements as it grows, so there is nothing to reserve for them.
+    void reserve(size_type n) {
+        if (index_.empty() && n <= N) {
+            return;
+        }
+        auto capacity = capacity_for(n + 1);
+        if (capacity > index_.size()) {
+            rebuild_index(capacity);
+        }
+    }
+
+    // Compact away erased elements and release unused memory, going
+    // back to scanning the inline slots if all the elements fit there
+    void shrink_to_fit() {
+        if (dead_ != 0) {
+            compact(slot_count());
+        }
+        if (index_.empty()) {
+            return;
+        }
+        if (slot_count() > N) {
+            overflow_->shrink_to_fit();
+            rebuild_index(capacity_for(size() + 1));
+            return;
+        }
+        std::array<std::size_t, N> hashes{};
+        for (size_type i = 0; i < used_; ++i) {
+            hashes[i] = hash_(inline_[i]->first);
+        }
+        hashes_ = hashes;
+        overflow_.reset();
+        index_type(index_.get_allocator()).swap(index_);
+        filled_ = 0;
     }
 
     constexpr void clear() noexcept {
-        map_.clear();
-        vec_.clear();
+        index_.clear();
+        overflow_.reset();
+        for (size_type i = 0; i < used_; ++i) {
+            inline_[i].reset();
+        }
+        used_ = 0;
+        dead_ = 0;
+        head_ = 0;
+        filled_ = 0;
     }
 
     constexpr std::pair<iterator, bool> insert(const value_type& value) {
-        auto p = map_.insert(value);
-        track_insert(p);
-        return order_iterator(p);
+        return emplace(value);
     }
 
     template <typename P>
     constexpr std::pair<iterator, bool> insert(P&& value) {
-        auto p = map_.insert(std::forward<P>(value));
-        track_insert(p);
-        return order_iterator(p);
+        return emplace(std::forward<P>(value));
     }
 
     template <typename... Args>
     constexpr std::pair<iterator, bool> try_emplace(
         const key_type& k, Args&&... args) {
-        auto p = map_.try_emplace(k, std::forward<Args>(args)...);
-        track_insert(p);
-        return order_iterator(p);
+        auto h = hash_(k);
+        auto pos = find_pos(k, h);
+        if (pos != npos) {
+            return std::make_pair(iterator(this, pos), false);
+        }
+        return std::make_pair(append(h, k, std::forward<Args>(args)...), true);
     }
 
     template <typename... Args>
     constexpr std::pair<iterator, bool> try_emplace(
         key_type&& k, Args&&... args) {
-        auto p = map_.try_emplace(
-            std::forward<key_type>(k), std::forward<Args>(args)...);
-        track_insert(p);
-        return order_iterator(p);
+        auto h = hash_(k);
+        auto pos = find_pos(k, h);
+        if (pos != npos) {
+            return std::make_pair(iterator(this, pos), false);
+        }
+        return std::make_pair(
+            append(h, std::move(k), std::forward<Args>(args)...), true);
     }
 
+    // Like std::unordered_map, the element is constructed before
+    // checking whether its key is already present
     template <typename... Args>
     constexpr std::pair<iterator, bool> emplace(Args&&... args) {
-        auto p = map_.emplace(std::forward<Args>(args)...);
-        track_insert(p);
-        return order_iterator(p);
+        push_slot(std::forward<Args>(args)...);
+        return add_back();
+    }
+
+    // Erasing invalidates iterators and references to the erased
+    // element, and to every element if it triggers a compaction.
+    // Returns an iterator to the element after the erased one.
+    iterator erase(iterator pos) {
+        return iterator(this, erase_at(pos.pos_));
+    }
+
+    iterator erase(const_iterator pos) {
+        return iterator(this, erase_at(pos.pos_));
+    }
+
+    // Returns the number of elements erased, zero or one
+    size_type erase(const key_type& key) {
+        auto pos = find_pos(key);
+        if (pos == npos) {
+            return 0;
+        }
+        erase_at(pos);
+        return 1;
+    }
+
+    constexpr iterator find(const key_type& key) {
+        auto pos = find_pos(key);
+        return pos == npos ? end() : iterator(this, pos);
+    }
+
+    constexpr const_iterator find(const key_type& key) const {
+        auto pos = find_pos(key);
+        return pos == npos ? end() : const_iterator(this, pos);
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr iterator find(const K& key) {
+        auto pos = find_pos(key);
+        return pos == npos ? end() : iterator(this, pos);
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr const_iterator find(const K& key) const {
+        auto pos = find_pos(key);
+        return pos == npos ? end() : const_iterator(this, pos);
+    }
+
+    constexpr bool contains(const key_type& key) const {
+        return find_pos(key) != npos;
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr bool contains(const K& key) const {
+        return find_pos(key) != npos;
     }
 
     constexpr T& at(const key_type& key) {
-        return map_.at(key);
+        return at_pos(find_pos(key));
     }
 
     constexpr const T& at(const key_type& key) const {
-        return map_.at(key);
+        return at_pos(find_pos(key));
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr T& at(const K& key) {
+        return at_pos(find_pos(key));
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr const T& at(const K& key) const {
+        return at_pos(find_pos(key));
     }
 
     constexpr T& operator[](const key_type& key) {
@@ -393,7 +1797,7 @@ public:
              lhs_it != std::end(lhs) && rhs_it != std::end(rhs);
              ++lhs_it, ++rhs_it) {
             if (lhs_it->first != rhs_it->first ||
-                lhs_it->second != lhs_it->second) {
+                lhs_it->second != rhs_it->second) {
                 return false;
             }
         }
@@ -404,230 +1808,2171 @@ public:
         const OrderPreservingMap& lhs, const OrderPreservingMap& rhs) {
         return !operator==(lhs, rhs);
     }
-};
-
-} // namespace detail
-
-// R is any `Resolver` class, namely any class that implements the same
-// public interface as BasicResolver.
-//
-// The parameter pack U contains the possible types that can be stored.
-// There are the following requirements on parameters in U:
-//   - U shall contain no duplicate types
-//   - Any template parameter T used in the interface must be an
-//     instance of one of the Us, although this should be caught at
-//     compile time.
-//   - The following functions should be defined for each T
-//
-//     std::ostream& operator<<(std::ostream&, const T&);
-//     std::istream& operator>>(std::istream&, T&);
-//
-//   - Each T must be default constructible.
-template <typename R, typename... U> class Basic : public detail::TypeInstance {
-public:
-    using Variant = std::variant<U...>;
-    using Types = detail::Pack<U...>;
-    using Resolver = R;
 
-    // Construct from one of the underlying types
-    template <typename T> constexpr explicit Basic(const T& rhs) : v_(rhs) {
-    }
+};
 
-    constexpr explicit Basic(const detail::TypeInstance& rhs)
-        : Basic(dynamic_cast<const Basic<R, U...>&>(rhs)) {
-    }
+template <typename Key,
+    typename T,
+    typename Hash,
+    typename KeyEqual,
+    typename Allocator>
+class CompactOrderPreservingMap;
 
-    // Write current value to a stream
-    std::ostream& write(std::ostream& os) const override {
-        std::visit([&os](auto&& arg) { os << arg; }, v_);
-        return os;
-    }
+// Random access iterator class for the CompactOrderPreservingMap, const
+// or nonconst as for OrderPreservingMap. The map stores std::pair<Key, T>
+// so that its entries are moved rather than copied when the storage
+// grows. There is no std::pair<const Key, T> to refer to, so like the
+// iterators of std::vector<bool> this dereferences to a proxy, whose
+// first is a const reference to the key and second a reference to the
+// value. Bind it with auto or const auto&, not auto&.
+template <bool IsConst, typename Key, typename T>
+class CompactOrderPreservingMapIteratorImpl {
+    template <bool, typename, typename>
+    friend class CompactOrderPreservingMapIteratorImpl;
 
-    // Read from a stream, under the assumption that the stream contains
-    // data of the same type currently stored
-    std::istream& read(std::istream& is) override {
-        std::visit([&is](auto&& arg) { is >> arg; }, v_);
-        return is;
-    }
+    template <typename, typename, typename, typename, typename>
+    friend class CompactOrderPreservingMap;
 
-    // Get the underlying value
-    // throws std::bad_variant_access if the currently stored value is
-    // not of type T
-    template <typename T> constexpr const T& get() const {
-        return std::get<T>(v_);
-    }
+    using entry_pointer = typename std::conditional<IsConst,
+        const std::pair<Key, T>*,
+        std::pair<Key, T>*>::type;
 
-    // Construct a new Basic containing a T from an input stream
-    template <typename T> static Basic<R, U...> create(std::istream& is) {
-        Basic<R, U...> b = Basic<R, U...>(T());
-        b.read(is);
-        return b;
-    }
+    entry_pointer entry_ = nullptr;
 
-    // Construct a new Basic containing a type from an input stream,
-    // using the Resolver to resolve the type string
-    static Basic<R, U...> create(const std::string& type, std::istream& is) {
-        return Resolver::resolveBasic(type)(is);
+    constexpr explicit CompactOrderPreservingMapIteratorImpl(
+        entry_pointer entry)
+        : entry_(entry) {
     }
 
-private:
-    Variant v_;
-};
+public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::pair<const Key, T>;
+    using iterator_category = std::random_access_iterator_tag;
 
-template <typename R, typename... U>
-std::ostream& operator<<(std::ostream& os, const Basic<R, U...>& b) {
-    return b.write(os);
-}
+    struct reference {
+        const Key& first;
+        typename std::conditional<IsConst, const T&, T&>::type second;
 
-template <typename R, typename... U>
-std::istream& operator>>(std::istream& is, Basic<R, U...>& b) {
-    return b.read(is);
-}
+        operator value_type() const {
+            return value_type(first, second);
+        }
+    };
 
-template <typename R> class CompoundInstance;
+    // Result of operator->, holding the proxy it points to
+    struct pointer {
+        reference entry;
 
-class CompoundType {
-public:
-    struct Member {
-        std::string type;
+        const reference* operator->() const {
+            return &entry;
+        }
     };
 
-private:
-    std::string name_;
-    using container_type = detail::OrderPreservingMap<std::string, Member>;
-    const container_type members_;
+    constexpr CompactOrderPreservingMapIteratorImpl() = default;
 
-public:
-    CompoundType(
-        std::string name, std::initializer_list<container_type::value_type> l)
-        : name_(std::move(name)), members_(l) {
+    // Nonconst iterators convert to const ones
+    template <bool C = IsConst, typename = std::enable_if_t<C>>
+    constexpr CompactOrderPreservingMapIteratorImpl(
+        const CompactOrderPreservingMapIteratorImpl<false, Key, T>& rhs)
+        : entry_(rhs.entry_) {
     }
 
-    const container_type& members() const {
-        return members_;
+    constexpr reference operator*() const {
+        return reference{entry_->first, entry_->second};
     }
 
-    std::string name() const {
-        return name_;
+    constexpr pointer operator->() const {
+        return pointer{**this};
     }
 
-    template <typename R> CompoundInstance<R> create(std::istream& is) const {
-        return CompoundInstance<R>(name_, is);
+    constexpr reference operator[](difference_type n) const {
+        return *(*this + n);
     }
 
-    friend inline bool operator==(
-        const CompoundType& lhs, const CompoundType& rhs) {
-        return lhs.name() == rhs.name() && lhs.members_ == rhs.members_;
+    constexpr CompactOrderPreservingMapIteratorImpl& operator++() {
+        ++entry_;
+        return *this;
     }
 
-    friend inline bool operator!=(
-        const CompoundType& lhs, const CompoundType& rhs) {
+    constexpr const CompactOrderPreservingMapIteratorImpl operator++(int) {
+        auto tmp(*this);
+        operator++();
+        return tmp;
+    }
+
+    constexpr CompactOrderPreservingMapIteratorImpl& operator--() {
+        --entry_;
+        return *this;
+    }
+
+    constexpr const CompactOrderPreservingMapIteratorImpl operator--(int) {
+        auto tmp(*this);
+        operator--();
+        return tmp;
+    }
+
+    constexpr CompactOrderPreservingMapIteratorImpl& operator+=(
+        difference_type n) {
+        entry_ += n;
+        return *this;
+    }
+
+    constexpr CompactOrderPreservingMapIteratorImpl& operator-=(
+        difference_type n) {
+        entry_ -= n;
+        return *this;
+    }
+
+    friend constexpr CompactOrderPreservingMapIteratorImpl operator+(
+        CompactOrderPreservingMapIteratorImpl it, difference_type n) {
+        return it += n;
+    }
+
+    friend constexpr CompactOrderPreservingMapIteratorImpl operator+(
+        difference_type n, CompactOrderPreservingMapIteratorImpl it) {
+        return it += n;
+    }
+
+    friend constexpr CompactOrderPreservingMapIteratorImpl operator-(
+        CompactOrderPreservingMapIteratorImpl it, difference_type n) {
+        return it -= n;
+    }
+
+    friend constexpr difference_type operator-(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return lhs.entry_ - rhs.entry_;
+    }
+
+    friend constexpr bool operator==(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return lhs.entry_ == rhs.entry_;
+    }
+
+    friend constexpr bool operator!=(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend constexpr bool operator<(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return lhs.entry_ < rhs.entry_;
+    }
+
+    friend constexpr bool operator>(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return rhs < lhs;
+    }
+
+    friend constexpr bool operator<=(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return !(rhs < lhs);
+    }
+
+    friend constexpr bool operator>=(
+        const CompactOrderPreservingMapIteratorImpl& lhs,
+        const CompactOrderPreservingMapIteratorImpl& rhs) {
+        return !(lhs < rhs);
+    }
+};
+
+// Alternative to OrderPreservingMap in the style of Python's compact
+// dict. Entries are stored densely in insertion order in one vector, and
+// an open-addressed table of 32-bit entry numbers is used to find them.
+// Iteration is a linear scan, a lookup touches the table and the entry,
+// and there are no per-entry allocations. Unlike OrderPreservingMap,
+// inserting may invalidate iterators and references to entries.
+template <typename Key,
+    typename T,
+    typename Hash = std::hash<Key>,
+    typename KeyEqual = std::equal_to<Key>,
+    typename Allocator = std::allocator<std::pair<const Key, T>>>
+class CompactOrderPreservingMap {
+    template <typename U>
+    using rebind_alloc =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+    using slot_type = std::uint32_t;
+    static constexpr slot_type emptySlot =
+        std::numeric_limits<slot_type>::max();
+
+    template <typename K, typename H = Hash>
+    using enable_transparent = std::enable_if_t<
+        IsTransparent<H, KeyEqual>::value && !std::is_same_v<K, Key>>;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+    using iterator = CompactOrderPreservingMapIteratorImpl<false, Key, T>;
+    using const_iterator = CompactOrderPreservingMapIteratorImpl<true, Key, T>;
+    // Proxies, as the iterators return
+    using reference = typename iterator::reference;
+    using const_reference = typename const_iterator::reference;
+    using pointer = typename iterator::pointer;
+    using const_pointer = typename const_iterator::pointer;
+
+private:
+    // Keys are only const through the iterators, so that the vector can
+    // move entries when it grows
+    using entry_type = std::pair<Key, T>;
+    using entry_vec_type = std::vector<entry_type, rebind_alloc<entry_type>>;
+
+private:
+    // entries_[i] is the (i+1)-th element inserted and hashes_[i] is the
+    // hash of its key. index_ has a power of two size, and each slot is
+    // either emptySlot or the number of an entry.
+    entry_vec_type entries_;
+    std::vector<std::size_t, rebind_alloc<std::size_t>> hashes_;
+    std::vector<slot_type, rebind_alloc<slot_type>> index_;
+    hasher hash_;
+    key_equal equal_;
+
+    static constexpr size_type npos = std::numeric_limits<size_type>::max();
+
+    constexpr size_type mask() const noexcept {
+        return index_.size() - 1;
+    }
+
+    // Number of the entry with the given key, or npos if there is none
+    template <typename K>
+    constexpr size_type find_entry(const K& key, std::size_t h) const {
+        if (index_.empty()) {
+            return npos;
+        }
+        for (auto i = h & mask();; i = (i + 1) & mask()) {
+            auto slot = index_[i];
+            if (slot == emptySlot) {
+                return npos;
+            }
+            if (hashes_[slot] == h && equal_(entries_[slot].first, key)) {
+                return slot;
+            }
+        }
+    }
+
+    // Point the first free slot for the hash at entry n
+    constexpr void index_entry(size_type n) {
+        auto i = hashes_[n] & mask();
+        while (index_[i] != emptySlot) {
+            i = (i + 1) & mask();
+        }
+        index_[i] = static_cast<slot_type>(n);
+    }
+
+    // Rebuild the index with the given number of slots, which must be a
+    // power of two large enough for every entry
+    constexpr void rehash_slots(size_type slots) {
+        index_.assign(slots, emptySlot);
+        for (size_type n = 0; n < entries_.size(); ++n) {
+            index_entry(n);
+        }
+    }
+
+    // Smallest number of index slots which can hold n entries
+    static constexpr size_type slots_for(size_type n) {
+        size_type slots = 8;
+        while (slots * 2 < n * 3) {
+            slots *= 2;
+        }
+        return slots;
+    }
+
+    // Keep the index at most two thirds full once an entry is added
+    constexpr void grow_for_insert() {
+        if (entries_.size() >= emptySlot - 1) {
+            throw std::length_error("CompactOrderPreservingMap too large");
+        }
+        if ((entries_.size() + 1) * 3 > index_.size() * 2) {
+            rehash_slots(index_.empty() ? 8 : index_.size() * 2);
+        }
+    }
+
+    // Shared implementations of the const and nonconst lookups
+    template <typename Self, typename K>
+    static constexpr auto find_impl(Self& self, const K& key) {
+        auto n = self.find_entry(key, self.hash_(key));
+        return n == npos ? std::end(self) : self.nth(n);
+    }
+
+    template <typename Self, typename K>
+    static constexpr auto& at_impl(Self& self, const K& key) {
+        auto n = self.find_entry(key, self.hash_(key));
+        if (n == npos) {
+            throw std::out_of_range("CompactOrderPreservingMap::at");
+        }
+        return self.entries_[n].second;
+    }
+
+    // Add a new entry constructed from args, which must not already be
+    // present, returning an iterator to it
+    template <typename... Args>
+    iterator append(std::size_t h, Args&&... args) {
+        grow_for_insert();
+        entries_.emplace_back(std::forward<Args>(args)...);
+        try {
+            hashes_.push_back(h);
+        } catch (...) {
+            entries_.pop_back();
+            throw;
+        }
+        index_entry(entries_.size() - 1);
+        return iterator(&entries_.back());
+    }
+
+public:
+    constexpr CompactOrderPreservingMap(std::initializer_list<value_type> init,
+        size_type bucket_count = 0,
+        const hasher& hash = hasher(),
+        const key_equal& equal = key_equal(),
+        const allocator_type& alloc = allocator_type())
+        : entries_(alloc),
+          hashes_(alloc),
+          index_(alloc),
+          hash_(hash),
+          equal_(equal) {
+        (void)bucket_count;
+        for (const auto& x : init) {
+            emplace(x);
+        }
+    }
+
+    constexpr CompactOrderPreservingMap() = default;
+
+    constexpr explicit CompactOrderPreservingMap(const allocator_type& alloc)
+        : entries_(alloc), hashes_(alloc), index_(alloc) {
+    }
+
+    constexpr CompactOrderPreservingMap(
+        const CompactOrderPreservingMap& /*unused*/) = default;
+
+    constexpr CompactOrderPreservingMap(
+        const CompactOrderPreservingMap& rhs, const allocator_type& alloc)
+        : entries_(rhs.entries_, alloc),
+          hashes_(rhs.hashes_, alloc),
+          index_(rhs.index_, alloc),
+          hash_(rhs.hash_),
+          equal_(rhs.equal_) {
+    }
+
+    constexpr CompactOrderPreservingMap& operator=(
+        const CompactOrderPreservingMap& /*unused*/) = default;
+
+    constexpr CompactOrderPreservingMap(
+        CompactOrderPreservingMap&& /*unused*/) noexcept = default;
+
+    constexpr CompactOrderPreservingMap& operator=(
+        CompactOrderPreservingMap&& /*unused*/) = default;
+
+    ~CompactOrderPreservingMap() = default;
+
+    constexpr allocator_type get_allocator() const {
+        return allocator_type(entries_.get_allocator());
+    }
+
+    constexpr iterator begin() noexcept {
+        return iterator(entries_.data());
+    }
+
+    constexpr iterator end() noexcept {
+        return iterator(entries_.data() + entries_.size());
+    }
+
+    constexpr const_iterator begin() const noexcept {
+        return const_iterator(entries_.data());
+    }
+
+    constexpr const_iterator end() const noexcept {
+        return const_iterator(entries_.data() + entries_.size());
+    }
+
+    // Iterator to the n-th element in insertion order, in O(1)
+    constexpr iterator nth(size_type n) {
+        return iterator(entries_.data() + n);
+    }
+
+    constexpr const_iterator nth(size_type n) const {
+        return const_iterator(entries_.data() + n);
+    }
+
+    constexpr bool empty() const noexcept {
+        return entries_.empty();
+    }
+
+    constexpr size_type size() const noexcept {
+        return entries_.size();
+    }
+
+    constexpr size_type max_size() const noexcept {
+        return std::min<size_type>(entries_.max_size(), emptySlot - 1);
+    }
+
+    constexpr size_type bucket_count() const noexcept {
+        return index_.size();
+    }
+
+    constexpr float load_factor() const noexcept {
+        return index_.empty() ? 0.0f
+                              : static_cast<float>(size()) /
+                static_cast<float>(index_.size());
+    }
+
+    // The index grows before it becomes more than two thirds full
+    constexpr float max_load_factor() const noexcept {
+        return 2.0f / 3.0f;
+    }
+
+    // Rebuild the index with at least count slots, and enough for the
+    // current entries
+    void rehash(size_type count) {
+        auto slots = slots_for(entries_.size());
+        while (slots < count) {
+            slots *= 2;
+        }
+        rehash_slots(slots);
+    }
+
+    // Make room for n entries without reallocating or rehashing
+    void reserve(size_type n) {
+        entries_.reserve(n);
+        hashes_.reserve(n);
+        auto slots = slots_for(n);
+        if (slots > index_.size()) {
+            rehash_slots(slots);
+        }
+    }
+
+    void shrink_to_fit() {
+        entries_.shrink_to_fit();
+        hashes_.shrink_to_fit();
+        if (entries_.empty()) {
+            index_.clear();
+            index_.shrink_to_fit();
+        } else {
+            rehash_slots(slots_for(entries_.size()));
+            index_.shrink_to_fit();
+        }
+    }
+
+    constexpr void clear() noexcept {
+        entries_.clear();
+        hashes_.clear();
+        index_.clear();
+    }
+
+    constexpr std::pair<iterator, bool> insert(const value_type& value) {
+        return emplace(value);
+    }
+
+    template <typename P>
+    constexpr std::pair<iterator, bool> insert(P&& value) {
+        return emplace(std::forward<P>(value));
+    }
+
+    template <typename... Args>
+    constexpr std::pair<iterator, bool> try_emplace(
+        const key_type& k, Args&&... args) {
+        auto h = hash_(k);
+        auto n = find_entry(k, h);
+        if (n != npos) {
+            return std::make_pair(nth(n), false);
+        }
+        return std::make_pair(append(h,
+                                  std::piecewise_construct,
+                                  std::forward_as_tuple(k),
+                                  std::forward_as_tuple(
+                                      std::forward<Args>(args)...)),
+            true);
+    }
+
+    template <typename... Args>
+    constexpr std::pair<iterator, bool> try_emplace(
+        key_type&& k, Args&&... args) {
+        auto h = hash_(k);
+        auto n = find_entry(k, h);
+        if (n != npos) {
+            return std::make_pair(nth(n), false);
+        }
+        return std::make_pair(append(h,
+                                  std::piecewise_construct,
+                                  std::forward_as_tuple(std::move(k)),
+                                  std::forward_as_tuple(
+                                      std::forward<Args>(args)...)),
+            true);
+    }
+
+    // Like std::unordered_map, the value is constructed before checking
+    // whether the key is already present
+    template <typename... Args>
+    constexpr std::pair<iterator, bool> emplace(Args&&... args) {
+        entry_type value(std::forward<Args>(args)...);
+        auto h = hash_(value.first);
+        auto n = find_entry(value.first, h);
+        if (n != npos) {
+            return std::make_pair(nth(n), false);
+        }
+        return std::make_pair(append(h, std::move(value)), true);
+    }
+
+    constexpr iterator find(const key_type& key) {
+        return find_impl(*this, key);
+    }
+
+    constexpr const_iterator find(const key_type& key) const {
+        return find_impl(*this, key);
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr iterator find(const K& key) {
+        return find_impl(*this, key);
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr const_iterator find(const K& key) const {
+        return find_impl(*this, key);
+    }
+
+    constexpr bool contains(const key_type& key) const {
+        return find_entry(key, hash_(key)) != npos;
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr bool contains(const K& key) const {
+        return find_entry(key, hash_(key)) != npos;
+    }
+
+    constexpr T& at(const key_type& key) {
+        return at_impl(*this, key);
+    }
+
+    constexpr const T& at(const key_type& key) const {
+        return at_impl(*this, key);
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr T& at(const K& key) {
+        return at_impl(*this, key);
+    }
+
+    template <typename K, typename = enable_transparent<K>>
+    constexpr const T& at(const K& key) const {
+        return at_impl(*this, key);
+    }
+
+    constexpr T& operator[](const key_type& key) {
+        return try_emplace(key).first->second;
+    }
+
+    constexpr T& operator[](key_type&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    // Equality respects insertion order
+    friend constexpr inline bool operator==(
+        const CompactOrderPreservingMap& lhs,
+        const CompactOrderPreservingMap& rhs) {
+        return lhs.entries_ == rhs.entries_;
+    }
+
+    friend constexpr inline bool operator!=(
+        const CompactOrderPreservingMap& lhs,
+        const CompactOrderPreservingMap& rhs) {
+        return !operator==(lhs, rhs);
+    }
+};
+
+// Storage strategy of an order preserving map
+enum class MapStorage {
+    // OrderPreservingMap, small maps inline and stable references on insert
+    Node,
+    // CompactOrderPreservingMap, dense entries and a compact index
+    Compact
+};
+
+// Order preserving map using the given storage strategy
+template <MapStorage S,
+    typename Key,
+    typename T,
+    typename Hash = std::hash<Key>,
+    typename KeyEqual = std::equal_to<Key>,
+    typename Allocator = std::allocator<std::pair<const Key, T>>>
+using BasicOrderPreservingMap = std::conditional_t<S == MapStorage::Node,
+    OrderPreservingMap<Key, T, Hash, KeyEqual, Allocator>,
+    CompactOrderPreservingMap<Key, T, Hash, KeyEqual, Allocator>>;
+
+} // namespace detail
+
+// R is any `Resolver` class, namely any class that implements the same
+// public interface as BasicResolver.
+//
+// The parameter pack U contains the possible types that can be stored.
+// There are the following requirements on parameters in U:
+//   - U shall contain no duplicate types
+//   - Any template parameter T used in the interface must be an
+//     instance of one of the Us, although this should be caught at
+//     compile time.
+//   - The following functions should be defined for each T
+//
+//     std::ostream& operator<<(std::ostream&, const T&);
+//     std::istream& operator>>(std::istream&, T&);
+//
+//   - Each T must be default constructible.
+template <typename R, typename... U> class Basic : public detail::TypeInstance {
+public:
+    using Variant = std::variant<U...>;
+    using Types = detail::Pack<U...>;
+    using Alternatives = detail::Alternatives<U...>;
+    using Resolver = R;
+
+    // Index of the alternative T in U...
+    template <typename T> static constexpr std::size_t indexOf() {
+        return detail::IndexOf<T, U...>::value;
+    }
+
+    // Construct from one of the underlying types
+    template <typename T>
+    constexpr explicit Basic(const T& rhs)
+        : TypeInstance(Kind::Basic), v_(rhs) {
+    }
+
+    constexpr explicit Basic(const detail::TypeInstance& rhs)
+        : Basic(dynamic_cast<const Basic<R, U...>&>(rhs)) {
+    }
+
+    std::unique_ptr<TypeInstance, detail::ResourceDelete> clone(
+        std::pmr::memory_resource* resource) const override {
+        return detail::allocateInstance<Basic<R, U...>>(resource, *this);
+    }
+
+    // Write current value to a stream
+    std::ostream& write(std::ostream& os) const override {
+        std::visit([&os](auto&& arg) { os << arg; }, v_);
+        return os;
+    }
+
+    // Read from a stream, under the assumption that the stream contains
+    // data of the same type currently stored
+    std::istream& read(std::istream& is) override {
+        std::visit([&is](auto&& arg) { is >> arg; }, v_);
+        return is;
+    }
+
+    TextScanner& read(TextScanner& s) override {
+        std::visit([&s](auto&& arg) { detail::scan(s, arg); }, v_);
+        return s;
+    }
+
+    std::ostream& writeBinary(std::ostream& os) const override {
+        std::visit([&os](auto&& arg) { detail::writeBinary(os, arg); }, v_);
+        return os;
+    }
+
+    std::istream& readBinary(std::istream& is) override {
+        std::visit([&is](auto&& arg) { detail::readBinary(is, arg); }, v_);
+        return is;
+    }
+
+    // Get the underlying value
+    // throws std::bad_variant_access if the currently stored value is
+    // not of type T
+    template <typename T> constexpr const T& get() const {
+        return std::get<T>(v_);
+    }
+
+    // Index of the currently stored alternative in U...
+    constexpr std::size_t index() const noexcept {
+        return v_.index();
+    }
+
+    // Construct a new Basic containing a T from an input stream
+    template <typename T> static Basic<R, U...> create(std::istream& is) {
+        Basic<R, U...> b = Basic<R, U...>(T());
+        b.read(is);
+        return b;
+    }
+
+    // Construct a new Basic containing a type from an input stream,
+    // using the Resolver to resolve the type string
+    static Basic<R, U...> create(std::string_view type, std::istream& is) {
+        return Resolver::resolveBasic(type)(is);
+    }
+
+    template <typename T> static Basic<R, U...> create(TextScanner& s) {
+        Basic<R, U...> b = Basic<R, U...>(T());
+        b.read(s);
+        return b;
+    }
+
+    // Construct a new Basic containing a value-initialized index-th
+    // alternative
+    static Basic<R, U...> create(std::size_t index) {
+        static constexpr std::array<Basic<R, U...> (*)(), sizeof...(U)>
+            creators = {[]() { return Basic<R, U...>(U()); }...};
+        return creators[index]();
+    }
+
+    // Construct a new Basic containing the index-th alternative from an
+    // input stream
+    static Basic<R, U...> create(std::size_t index, std::istream& is) {
+        static constexpr std::array<Basic<R, U...> (*)(std::istream&),
+            sizeof...(U)>
+            creators = {&Basic<R, U...>::create<U>...};
+        return creators[index](is);
+    }
+
+    static Basic<R, U...> create(std::size_t index, TextScanner& s) {
+        static constexpr std::array<Basic<R, U...> (*)(TextScanner&),
+            sizeof...(U)>
+            creators = {&Basic<R, U...>::create<U>...};
+        return creators[index](s);
+    }
+
+    static Basic<R, U...> create(
+        std::size_t index, std::istream& is, BinaryFormat /*unused*/) {
+        Basic<R, U...> b = create(index);
+        b.readBinary(is);
+        return b;
+    }
+
+    static Basic<R, U...> create(std::string_view type, TextScanner& s) {
+        return create(Resolver::resolveBasic(type).index, s);
+    }
+
+    // Construct a new Basic containing a type from a stream in the binary
+    // format
+    static Basic<R, U...> create(
+        std::string_view type, std::istream& is, BinaryFormat format) {
+        return create(Resolver::resolveBasic(type).index, is, format);
+    }
+
+private:
+    Variant v_;
+};
+
+template <typename R, typename... U>
+std::ostream& operator<<(std::ostream& os, const Basic<R, U...>& b) {
+    return b.write(os);
+}
+
+template <typename R, typename... U>
+std::istream& operator>>(std::istream& is, Basic<R, U...>& b) {
+    return b.read(is);
+}
+
+template <typename R, typename... U>
+TextScanner& operator>>(TextScanner& s, Basic<R, U...>& b) {
+    return b.read(s);
+}
+
+class CompoundType;
+template <typename R> class CompoundInstance;
+template <typename R> class FlatInstance;
+template <typename R> class RecordBatch;
+template <typename R> class RecordParser;
+
+// Dense integer assigned to each type name by a resolver
+using TypeId = std::size_t;
+inline constexpr TypeId noTypeId = std::numeric_limits<TypeId>::max();
+
+// What a resolver knows about a type name, found with a single lookup
+struct TypeDescriptor {
+    enum class Kind { None, Basic, Compound };
+
+    Kind kind = Kind::None;
+    // Index of the alternative in the resolver's Basic, if kind is Basic
+    std::size_t index = 0;
+    // The registered type, if kind is Compound
+    const CompoundType* compound = nullptr;
+};
+
+// Precompiled location of a basic field of type T within a compound,
+// obtained once from a CompoundType with a layout by CompoundType::field.
+// Accessing an instance through a handle does no hashing, string
+// comparison or dynamic_cast. A handle must only be used with instances
+// of the type it was obtained from.
+template <typename T> struct FieldHandle {
+    // Offset of the field within a FlatInstance
+    std::size_t offset;
+    // Position of the member at each level of nesting within a
+    // CompoundInstance
+    std::vector<std::size_t> positions;
+};
+
+// Fixed byte layout of a CompoundType, with the members of nested
+// compounds inlined into their parent. Fields are keyed by their dotted
+// path from the outermost type, e.g. "m.d", and are stored in the order
+// they appear in the text format.
+struct Layout {
+    struct Field {
+        // Index of the alternative in the Basic of the resolver that
+        // computed the layout
+        std::size_t index;
+        std::size_t offset;
+        std::size_t size;
+        std::size_t alignment;
+        // Position of the member at each level of nesting, e.g. "m.d"
+        // is the second member of the second member
+        std::vector<std::size_t> positions;
+    };
+
+    std::size_t size = 0;
+    std::size_t alignment = 1;
+    // Looked up once per handle rather than per record, so few fields
+    // are kept inline
+    detail::OrderPreservingMap<std::string,
+        Field,
+        detail::StringHash,
+        std::equal_to<>,
+        std::allocator<std::pair<const std::string, Field>>,
+        2>
+        fields;
+    // Type of each direct member in order, which cannot change once
+    // every member is resolved
+    std::vector<TypeDescriptor> members;
+};
+
+class CompoundType {
+public:
+    struct Member {
+        std::string type;
+        // Interned type, set when the enclosing type is registered
+        TypeId id = noTypeId;
+    };
+
+private:
+    std::string name_;
+    // There is one of each type rather than one per record, so few
+    // members are kept inline
+    using container_type = detail::OrderPreservingMap<std::string,
+        Member,
+        detail::StringHash,
+        std::equal_to<>,
+        std::allocator<std::pair<const std::string, Member>>,
+        2>;
+    container_type members_;
+    // Set once the type has been registered with a resolver, which is
+    // identified by resolver_ and describes members through describe_
+    TypeId id_ = noTypeId;
+    const void* resolver_ = nullptr;
+    TypeDescriptor (*describe_)(const void*, const Member&) = nullptr;
+    // Only present once the type has been registered with a resolver
+    // that could resolve every member. That may happen after the type is
+    // published, when a type it refers to is registered, so readers find
+    // the layout through published_, which is set once it is complete.
+    std::optional<Layout> layout_;
+    std::atomic<const Layout*> published_{nullptr};
+
+public:
+    CompoundType(
+        std::string name, std::initializer_list<container_type::value_type> l)
+        : name_(std::move(name)), members_(l) {
+    }
+
+    CompoundType(const CompoundType& rhs)
+        : name_(rhs.name_),
+          members_(rhs.members_),
+          id_(rhs.id_),
+          resolver_(rhs.resolver_),
+          describe_(rhs.describe_) {
+        if (const auto* layout = rhs.layout()) {
+            layout_ = *layout;
+            published_.store(&*layout_, std::memory_order_relaxed);
+        }
+    }
+
+    CompoundType& operator=(const CompoundType& rhs) {
+        if (this != &rhs) {
+            CompoundType copy(rhs);
+            name_ = std::move(copy.name_);
+            members_ = std::move(copy.members_);
+            id_ = copy.id_;
+            resolver_ = copy.resolver_;
+            describe_ = copy.describe_;
+            published_.store(nullptr, std::memory_order_relaxed);
+            layout_ = std::move(copy.layout_);
+            if (layout_) {
+                published_.store(&*layout_, std::memory_order_relaxed);
+            }
+        }
+        return *this;
+    }
+
+    const container_type& members() const {
+        return members_;
+    }
+
+    std::string name() const {
+        return name_;
+    }
+
+    // The layout, or nullptr if the type has none yet
+    const Layout* layout() const {
+        return published_.load(std::memory_order_acquire);
+    }
+
+    TypeId id() const {
+        return id_;
+    }
+
+    // Describe a member using the resolver the type was registered with,
+    // or R if the type is not registered
+    template <typename R> TypeDescriptor describe(const Member& m) const {
+        return describe_ ? describe_(resolver_, m) : R::describe(m);
+    }
+
+    // This type if it is registered, or else the type of the same name
+    // registered with R
+    template <typename R> const CompoundType& resolve() const {
+        return resolver_ ? *this : R::resolveCompound(name_);
+    }
+
+    // Intern the name of the type and of each member's type with the
+    // resolver r, so that they can be resolved without hashing strings,
+    // and remember r for resolving members later. describe is called
+    // with r to describe a member.
+    template <typename Resolver>
+    void internNames(Resolver& r,
+        const void* resolver,
+        TypeDescriptor (*describe)(const void*, const Member&)) {
+        id_ = r.intern(name_);
+        for (auto& m : members_) {
+            m.second.id = r.intern(m.second.type);
+        }
+        resolver_ = resolver;
+        describe_ = describe;
+    }
+
+    // Compute the layout of the type, resolving members using r.
+    // Leaves the type without a layout if any member is not a basic
+    // type or a compound type with a layout. Once the type is published
+    // this may only be called while it has no layout.
+    template <typename Resolver> void computeLayout(const Resolver& r) {
+        using Alternatives = typename Resolver::BasicType::Alternatives;
+        Layout layout;
+        auto addField = [&layout](std::string path, Layout::Field field) {
+            layout.size = field.offset + field.size;
+            layout.alignment = std::max(layout.alignment, field.alignment);
+            layout.fields.emplace(std::move(path), std::move(field));
+        };
+
+        std::size_t position = 0;
+        for (const auto & [ name, member ] : members_) {
+            auto type = r.describe(member);
+            if (type.kind == TypeDescriptor::Kind::Basic) {
+                auto index = type.index;
+                auto alignment = Alternatives::alignment[index];
+                addField(name,
+                    {index,
+                        detail::alignUp(layout.size, alignment),
+                        Alternatives::size[index],
+                        alignment,
+                        {position}});
+            } else if (type.kind == TypeDescriptor::Kind::Compound &&
+                       type.compound->layout()) {
+                const auto& nested = *type.compound->layout();
+                auto base = detail::alignUp(layout.size, nested.alignment);
+                for (const auto & [ path, field ] : nested.fields) {
+                    std::vector<std::size_t> positions = {position};
+                    positions.insert(std::end(positions),
+                        std::begin(field.positions),
+                        std::end(field.positions));
+                    addField(name + "." + path,
+                        {field.index,
+                            base + field.offset,
+                            field.size,
+                            field.alignment,
+                            std::move(positions)});
+                }
+                // Keep any tail padding of the nested type
+                layout.size = base + nested.size;
+                layout.alignment = std::max(layout.alignment, nested.alignment);
+            } else {
+                published_.store(nullptr, std::memory_order_relaxed);
+                layout_.reset();
+                return;
+            }
+            layout.members.push_back(type);
+            ++position;
+        }
+
+        layout.size = detail::alignUp(layout.size, layout.alignment);
+        published_.store(nullptr, std::memory_order_relaxed);
+        layout_ = std::move(layout);
+        published_.store(&*layout_, std::memory_order_release);
+    }
+
+    // Get a handle to the basic field of type T with the given path,
+    // e.g. "m.d", where R is the resolver the type was registered with.
+    // throws std::runtime_error if the type has no layout,
+    // std::out_of_range if there is no such field, and
+    // std::bad_variant_access if the field is not of type T
+    template <typename R, typename T>
+    FieldHandle<T> field(std::string_view path) const {
+        const auto* layout = this->layout();
+        if (!layout) {
+            throw std::runtime_error("No layout for type: " + name_);
+        }
+        const auto& f = layout->fields.at(path);
+        if (f.index != R::BasicType::template indexOf<T>()) {
+            throw std::bad_variant_access();
+        }
+        return FieldHandle<T>{f.offset, f.positions};
+    }
+
+    template <typename R> CompoundInstance<R> create(std::istream& is) const {
+        return CompoundInstance<R>(resolve<R>(), is);
+    }
+
+    template <typename R> CompoundInstance<R> create(TextScanner& s) const {
+        return CompoundInstance<R>(resolve<R>(), s);
+    }
+
+    template <typename R>
+    CompoundInstance<R> create(std::istream& is, BinaryFormat format) const {
+        return CompoundInstance<R>(resolve<R>(), is, format);
+    }
+
+    template <typename R> FlatInstance<R> createFlat(std::istream& is) const {
+        return FlatInstance<R>(resolve<R>(), is);
+    }
+
+    template <typename R> FlatInstance<R> createFlat(TextScanner& s) const {
+        return FlatInstance<R>(resolve<R>(), s);
+    }
+
+    template <typename R>
+    FlatInstance<R> createFlat(std::istream& is, BinaryFormat format) const {
+        return FlatInstance<R>(resolve<R>(), is, format);
+    }
+
+    // Read up to n records into a RecordBatch, stopping early if the
+    // input runs out. Space for n records is reserved up front.
+    template <typename R>
+    RecordBatch<R> createBatch(std::istream& is, std::size_t n) const {
+        RecordBatch<R> batch(resolve<R>());
+        batch.reserve(n);
+        batch.read(is, n);
+        return batch;
+    }
+
+    template <typename R>
+    RecordBatch<R> createBatch(TextScanner& s, std::size_t n) const {
+        RecordBatch<R> batch(resolve<R>());
+        batch.reserve(n);
+        batch.read(s, n);
+        return batch;
+    }
+
+    template <typename R>
+    RecordBatch<R> createBatch(
+        std::istream& is, std::size_t n, BinaryFormat format) const {
+        RecordBatch<R> batch(resolve<R>());
+        batch.reserve(n);
+        batch.read(is, n, format);
+        return batch;
+    }
+
+    // Types registered with the same resolver are equal exactly when
+    // their ids are, otherwise they are compared structurally
+    friend inline bool operator==(
+        const CompoundType& lhs, const CompoundType& rhs) {
+        if (lhs.resolver_ != nullptr && lhs.resolver_ == rhs.resolver_) {
+            return lhs.id_ == rhs.id_;
+        }
+        return lhs.name_ == rhs.name_ && lhs.members_ == rhs.members_;
+    }
+
+    friend inline bool operator!=(
+        const CompoundType& lhs, const CompoundType& rhs) {
+        return !operator==(lhs, rhs);
+    }
+
+    friend inline bool operator==(const Member& lhs, const Member& rhs) {
+        return lhs.type == rhs.type;
+    }
+
+    friend inline bool operator!=(const Member& lhs, const Member& rhs) {
         return !operator==(lhs, rhs);
     }
+};
+
+// Instance of a CompoundType with each member allocated separately.
+// Members and the map holding them are allocated from a
+// std::pmr::memory_resource, which defaults to the default resource; to
+// free a batch of records at once, construct them all from a
+// std::pmr::monotonic_buffer_resource that outlives them.
+template <typename R> class CompoundInstance : public detail::TypeInstance {
+    using member_type = std::unique_ptr<detail::TypeInstance,
+        detail::ResourceDelete>;
+    using container_type = detail::OrderPreservingMap<std::string,
+        member_type,
+        detail::StringHash,
+        std::equal_to<>,
+        std::pmr::polymorphic_allocator<
+            std::pair<const std::string, member_type>>>;
+    using Resolver = R;
+    const CompoundType& type_;
+    container_type members_;
+
+    // Input is either a std::istream or a TextScanner, and Format is
+    // empty for the text format or BinaryFormat
+    template <typename Input, typename... Format>
+    Input& readMembers(Input& in, Format... format) {
+        members_.reserve(type_.members().size());
+        const auto& layout = type_.layout();
+        std::size_t position = 0;
+        for (const auto & [ name, member ] : type_.members()) {
+            auto type = layout ? layout->members[position++]
+                               : type_.describe<R>(member);
+            switch (type.kind) {
+            case TypeDescriptor::Kind::Basic:
+                members_[name] =
+                    detail::allocateInstance<typename R::BasicType>(
+                        resource(),
+                        R::BasicType::create(type.index, in, format...));
+                break;
+            case TypeDescriptor::Kind::Compound:
+                members_[name] = detail::allocateInstance<CompoundInstance<R>>(
+                    resource(), resource(), *type.compound, in, format...);
+                break;
+            default:
+                throw std::runtime_error("No such type: " + member.type);
+            }
+        }
+        return in;
+    }
+
+public:
+    // Instantiate a type by name. Input is either a std::istream or a
+    // TextScanner, and Format is empty for the text format or
+    // BinaryFormat.
+    template <typename Input, typename... Format>
+    CompoundInstance(std::string_view type, Input& in, Format... format)
+        : CompoundInstance(Resolver::resolveCompound(type), in, format...) {
+    }
+
+    template <typename Input, typename... Format>
+    CompoundInstance(std::pmr::memory_resource* resource,
+        std::string_view type,
+        Input& in,
+        Format... format)
+        : CompoundInstance(
+              resource, Resolver::resolveCompound(type), in, format...) {
+    }
+
+    // Instantiate a type owned by the resolver
+    template <typename Input, typename... Format>
+    CompoundInstance(const CompoundType& type, Input& in, Format... format)
+        : CompoundInstance(
+              std::pmr::get_default_resource(), type, in, format...) {
+    }
+
+    template <typename Input, typename... Format>
+    CompoundInstance(std::pmr::memory_resource* resource,
+        const CompoundType& type,
+        Input& in,
+        Format... format)
+        : TypeInstance(Kind::Compound), type_(type), members_(resource) {
+        readMembers(in, format...);
+    }
+
+    constexpr explicit CompoundInstance(const detail::TypeInstance& rhs)
+        : CompoundInstance(dynamic_cast<const CompoundInstance<R>&>(rhs)) {
+    }
+
+    // Like the standard containers, copies use the default resource
+    // unless one is given
+    constexpr CompoundInstance(const CompoundInstance<R>& rhs)
+        : CompoundInstance(std::pmr::get_default_resource(), rhs) {
+    }
+
+    CompoundInstance(
+        std::pmr::memory_resource* resource, const CompoundInstance<R>& rhs)
+        : TypeInstance(Kind::Compound), type_(rhs.type_), members_(resource) {
+        members_.reserve(rhs.members_.size());
+        for (const auto & [ name, m ] : rhs.members_) {
+            members_.emplace(name, m->clone(resource));
+        }
+    }
+
+    constexpr CompoundInstance& operator=(
+        const CompoundInstance& /*unused*/) = default;
+
+    CompoundInstance(CompoundInstance&& /*unused*/) noexcept = default;
+
+    CompoundInstance& operator=(
+        CompoundInstance&& /*unused*/) noexcept = default;
+
+    ~CompoundInstance() override = default;
+
+    std::unique_ptr<TypeInstance, detail::ResourceDelete> clone(
+        std::pmr::memory_resource* resource) const override {
+        return detail::allocateInstance<CompoundInstance<R>>(
+            resource, resource, *this);
+    }
+
+    std::ostream& write(std::ostream& os) const override {
+        for (const auto& m : members_) {
+            m.second->write(os);
+        }
+        return os;
+    }
+
+    std::istream& read(std::istream& is) override {
+        return readMembers(is);
+    }
+
+    TextScanner& read(TextScanner& s) override {
+        return readMembers(s);
+    }
+
+    std::ostream& writeBinary(std::ostream& os) const override {
+        for (const auto& m : members_) {
+            m.second->writeBinary(os);
+        }
+        return os;
+    }
+
+    std::istream& readBinary(std::istream& is) override {
+        return readMembers(is, binary);
+    }
+
+    const detail::TypeInstance& operator()(
+        std::string_view name) const override {
+        return *members_.at(name);
+    }
+
+    // Get the value of a basic member
+    // throws std::out_of_range if there is no such member,
+    // std::bad_cast if it is not basic, and std::bad_variant_access if
+    // it is not of type T
+    template <typename T> const T& get(std::string_view name) const {
+        const auto& m = *members_.at(name);
+        if (m.kind() != Kind::Basic) {
+            throw std::bad_cast();
+        }
+        return static_cast<const typename R::BasicType&>(m).template get<T>();
+    }
+
+    // Get a compound member
+    // throws std::out_of_range if there is no such member, and
+    // std::bad_cast if it is not a compound
+    const CompoundInstance<R>& get(std::string_view name) const {
+        const auto& m = *members_.at(name);
+        if (m.kind() != Kind::Compound) {
+            throw std::bad_cast();
+        }
+        return static_cast<const CompoundInstance<R>&>(m);
+    }
+
+    template <typename T> const T& get(const FieldHandle<T>& handle) const {
+        // The handle was computed from the type, so the kind of each
+        // member along the path is already known
+        const auto* instance = this;
+        auto last = std::prev(std::end(handle.positions));
+        for (auto it = std::begin(handle.positions); it != last; ++it) {
+            instance = static_cast<const CompoundInstance<R>*>(
+                instance->members_.nth(*it)->second.get());
+        }
+        return static_cast<const typename R::BasicType&>(
+            *instance->members_.nth(*last)->second)
+            .template get<T>();
+    }
+
+    const CompoundType& type() const {
+        return type_;
+    }
+
+    // The memory resource that members are allocated from
+    std::pmr::memory_resource* resource() const {
+        return members_.get_allocator().resource();
+    }
+};
+
+template <typename R>
+std::ostream& operator<<(std::ostream& os, const CompoundInstance<R>& x) {
+    return x.write(os);
+}
+
+template <typename R>
+std::istream& operator>>(std::istream& is, CompoundInstance<R>& x) {
+    return x.read(is);
+}
+
+template <typename R>
+TextScanner& operator>>(TextScanner& s, CompoundInstance<R>& x) {
+    return x.read(s);
+}
+
+namespace detail {
+
+// Returns type, for use in member initializers
+// throws std::runtime_error if the type has no layout
+inline const CompoundType& requireLayout(const CompoundType& type) {
+    if (!type.layout()) {
+        throw std::runtime_error("No layout for type: " + type.name());
+    }
+    return type;
+}
+
+// Alternative and offset of a field of a layout, which is all that
+// reading or destroying the field needs
+struct FieldStep {
+    std::size_t index;
+    std::size_t offset;
+};
+
+// The fields of a layout, in the order they are read
+inline std::vector<FieldStep> planFields(const Layout& layout) {
+    std::vector<FieldStep> plan;
+    plan.reserve(layout.fields.size());
+    for (const auto& f : layout.fields) {
+        plan.push_back(FieldStep{f.second.index, f.second.offset});
+    }
+    return plan;
+}
+
+} // namespace detail
+
+// Instance of a CompoundType stored in a single contiguous buffer
+// according to the type's Layout, instead of one allocation per member.
+// Only types with a layout can be instantiated, and members of nested
+// compounds are accessed by their dotted path, e.g. get<int>("m.i").
+template <typename R> class FlatInstance : public detail::TypeInstance {
+    friend class RecordParser<R>;
+    using Resolver = R;
+    using Alternatives = typename R::BasicType::Alternatives;
+    const CompoundType& type_;
+    detail::AlignedBuffer data_;
+
+    const Layout& layout() const {
+        return *type_.layout();
+    }
+
+    // Construct every field in place using op, destroying the ones
+    // already constructed if op throws
+    template <typename Op> void constructFields(Op op) {
+        const auto& fields = layout().fields;
+        auto it = std::begin(fields);
+        try {
+            for (; it != std::end(fields); ++it) {
+                op(it->second, data_.get() + it->second.offset);
+            }
+        } catch (...) {
+            while (it != std::begin(fields)) {
+                --it;
+                Alternatives::destroy[it->second.index](
+                    data_.get() + it->second.offset);
+            }
+            throw;
+        }
+    }
+
+    // Construct with every field value-initialized
+    explicit FlatInstance(const CompoundType& type)
+        : TypeInstance(Kind::Flat),
+          type_(detail::requireLayout(type)),
+          data_(detail::allocateAligned(
+              layout().size, layout().alignment)) {
+        constructFields([](const Layout::Field& f, std::byte* p) {
+            Alternatives::construct[f.index](p);
+        });
+    }
+
+    void destroyFields() {
+        if (!data_) {
+            return;
+        }
+        for (const auto& f : layout().fields) {
+            Alternatives::destroy[f.second.index](data_.get() + f.second.offset);
+        }
+    }
+
+public:
+    FlatInstance(std::string_view type, std::istream& is)
+        : FlatInstance(Resolver::resolveCompound(type), is) {
+    }
+
+    FlatInstance(std::string_view type, TextScanner& s)
+        : FlatInstance(Resolver::resolveCompound(type), s) {
+    }
+
+    FlatInstance(std::string_view type, std::istream& is, BinaryFormat format)
+        : FlatInstance(Resolver::resolveCompound(type), is, format) {
+    }
+
+    // Input is either a std::istream or a TextScanner
+    template <typename Input>
+    FlatInstance(const CompoundType& type, Input& in)
+        : FlatInstance(type) {
+        read(in);
+    }
+
+    FlatInstance(
+        const CompoundType& type, std::istream& is, BinaryFormat /*unused*/)
+        : FlatInstance(type) {
+        readBinary(is);
+    }
+
+    FlatInstance(const FlatInstance<R>& rhs)
+        : TypeInstance(Kind::Flat),
+          type_(rhs.type_),
+          data_(detail::allocateAligned(
+              layout().size, layout().alignment)) {
+        constructFields([&rhs](const Layout::Field& f, std::byte* p) {
+            Alternatives::copy[f.index](p, rhs.data_.get() + f.offset);
+        });
+    }
+
+    FlatInstance& operator=(const FlatInstance& /*unused*/) = delete;
+
+    FlatInstance(FlatInstance&& /*unused*/) noexcept = default;
+
+    FlatInstance& operator=(FlatInstance&& /*unused*/) = delete;
+
+    ~FlatInstance() override {
+        destroyFields();
+    }
+
+    std::unique_ptr<TypeInstance, detail::ResourceDelete> clone(
+        std::pmr::memory_resource* resource) const override {
+        return detail::allocateInstance<FlatInstance<R>>(resource, *this);
+    }
+
+    std::ostream& write(std::ostream& os) const override {
+        for (const auto& f : layout().fields) {
+            Alternatives::write[f.second.index](
+                os, data_.get() + f.second.offset);
+        }
+        return os;
+    }
+
+    std::istream& read(std::istream& is) override {
+        for (const auto& f : layout().fields) {
+            Alternatives::read[f.second.index](
+                is, data_.get() + f.second.offset);
+        }
+        return is;
+    }
+
+    TextScanner& read(TextScanner& s) override {
+        for (const auto& f : layout().fields) {
+            Alternatives::scan[f.second.index](
+                s, data_.get() + f.second.offset);
+        }
+        return s;
+    }
+
+    std::ostream& writeBinary(std::ostream& os) const override {
+        for (const auto& f : layout().fields) {
+            Alternatives::writeBinary[f.second.index](
+                os, data_.get() + f.second.offset);
+        }
+        return os;
+    }
+
+    std::istream& readBinary(std::istream& is) override {
+        for (const auto& f : layout().fields) {
+            Alternatives::readBinary[f.second.index](
+                is, data_.get() + f.second.offset);
+        }
+        return is;
+    }
+
+    // Get the value of the field with the given path
+    // throws std::out_of_range if there is no such field, and
+    // std::bad_variant_access if the field is not of type T
+    template <typename T> const T& get(std::string_view path) const {
+        const auto& field = layout().fields.at(path);
+        if (field.index != R::BasicType::template indexOf<T>()) {
+            throw std::bad_variant_access();
+        }
+        return *std::launder(
+            reinterpret_cast<const T*>(data_.get() + field.offset));
+    }
+
+    template <typename T> const T& get(const FieldHandle<T>& handle) const {
+        return *std::launder(
+            reinterpret_cast<const T*>(data_.get() + handle.offset));
+    }
+
+    const CompoundType& type() const {
+        return type_;
+    }
+};
+
+// Records of one CompoundType stored contiguously, each with the byte
+// layout of a FlatInstance. The fields to decode are gathered from the
+// layout into a flat plan once per batch, so reading many records is a
+// tight loop over the plan with no per-record lookups or allocations
+// beyond those of the field values themselves.
+template <typename R> class RecordBatch {
+    using Resolver = R;
+    using Alternatives = typename R::BasicType::Alternatives;
+
+    const CompoundType* type_;
+    std::vector<detail::FieldStep> plan_;
+    std::size_t stride_;
+    std::size_t alignment_;
+    detail::AlignedBuffer data_;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;
+
+    std::byte* record(std::size_t i) const {
+        return data_.get() + i * stride_;
+    }
+
+    // Value-initialize every field of the record at p
+    void constructRecord(std::byte* p) {
+        auto it = std::begin(plan_);
+        try {
+            for (; it != std::end(plan_); ++it) {
+                Alternatives::construct[it->index](p + it->offset);
+            }
+        } catch (...) {
+            while (it != std::begin(plan_)) {
+                --it;
+                Alternatives::destroy[it->index](p + it->offset);
+            }
+            throw;
+        }
+    }
+
+    void destroyRecord(std::byte* p) {
+        for (const auto& step : plan_) {
+            Alternatives::destroy[step.index](p + step.offset);
+        }
+    }
+
+    // Read up to n records, stopping early if the input fails. op reads
+    // the alternative with the given index into the given address. A
+    // record that reads nothing, e.g. of an empty type, would be read
+    // forever, so it also stops reading and is not kept. That can only
+    // happen if no field is a number or string, which read or fail, and
+    // only a type without fields is known to read nothing from a stream
+    // that cannot seek.
+    template <typename Input, typename Op>
+    std::size_t readWith(Input& in, std::size_t n, Op op) {
+        bool mayReadNothing = std::none_of(std::begin(plan_),
+            std::end(plan_),
+            [](const detail::FieldStep& step) {
+                return Alternatives::singleToken[step.index];
+            });
+        std::size_t count = 0;
+        for (; count < n; ++count) {
+            if (size_ == capacity_) {
+                reserve(std::max<std::size_t>(capacity_ * 2, 16));
+            }
+            auto* p = record(size_);
+            constructRecord(p);
+            auto start = mayReadNothing ? detail::readPosition(in) : -1;
+            try {
+                for (const auto& step : plan_) {
+                    op(in, step.index, p + step.offset);
+                }
+            } catch (...) {
+                destroyRecord(p);
+                throw;
+            }
+            if (!in || plan_.empty() ||
+                (start != -1 && detail::readPosition(in) == start)) {
+                destroyRecord(p);
+                break;
+            }
+            ++size_;
+        }
+        return count;
+    }
 
-    friend inline bool operator==(const Member& lhs, const Member& rhs) {
-        return lhs.type == rhs.type;
+public:
+    explicit RecordBatch(const CompoundType& type)
+        : type_(&detail::requireLayout(type)),
+          plan_(detail::planFields(*type.layout())),
+          stride_(detail::alignUp(
+              type.layout()->size, type.layout()->alignment)),
+          alignment_(type.layout()->alignment),
+          data_(detail::allocateAligned(0, alignment_)) {
     }
 
-    friend inline bool operator!=(const Member& lhs, const Member& rhs) {
-        return !operator==(lhs, rhs);
+    explicit RecordBatch(std::string_view type)
+        : RecordBatch(Resolver::resolveCompound(type)) {
+    }
+
+    RecordBatch(const RecordBatch& /*unused*/) = delete;
+
+    RecordBatch& operator=(const RecordBatch& /*unused*/) = delete;
+
+    RecordBatch(RecordBatch&& rhs) noexcept
+        : type_(rhs.type_),
+          plan_(std::move(rhs.plan_)),
+          stride_(rhs.stride_),
+          alignment_(rhs.alignment_),
+          data_(std::move(rhs.data_)),
+          size_(std::exchange(rhs.size_, 0)),
+          capacity_(std::exchange(rhs.capacity_, 0)) {
+    }
+
+    RecordBatch& operator=(RecordBatch&& /*unused*/) = delete;
+
+    ~RecordBatch() {
+        clear();
+    }
+
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    std::size_t capacity() const noexcept {
+        return capacity_;
+    }
+
+    // Make room for n records, moving the existing ones if necessary
+    void reserve(std::size_t n) {
+        if (n <= capacity_) {
+            return;
+        }
+        if (stride_ != 0 &&
+            n > std::numeric_limits<std::size_t>::max() / stride_) {
+            throw std::length_error("RecordBatch too large");
+        }
+        auto data = detail::allocateAligned(n * stride_, alignment_);
+        for (std::size_t i = 0; i < size_; ++i) {
+            auto* from = record(i);
+            auto* to = data.get() + i * stride_;
+            for (const auto& step : plan_) {
+                Alternatives::relocate[step.index](
+                    to + step.offset, from + step.offset);
+            }
+        }
+        data_ = std::move(data);
+        capacity_ = n;
+    }
+
+    void clear() noexcept {
+        for (std::size_t i = 0; i < size_; ++i) {
+            destroyRecord(record(i));
+        }
+        size_ = 0;
+    }
+
+    // Append up to n records read from the text format, returning how
+    // many were read. Input is either a std::istream or a TextScanner.
+    template <typename Input>
+    std::size_t read(Input& in,
+        std::size_t n = std::numeric_limits<std::size_t>::max()) {
+        return readWith(in, n, [](Input& is, std::size_t index, void* p) {
+            if constexpr (std::is_same_v<Input, TextScanner>) {
+                Alternatives::scan[index](is, p);
+            } else {
+                Alternatives::read[index](is, p);
+            }
+        });
+    }
+
+    std::size_t read(
+        std::istream& is, std::size_t n, BinaryFormat /*unused*/) {
+        return readWith(
+            is, n, [](std::istream& in, std::size_t index, void* p) {
+                Alternatives::readBinary[index](in, p);
+            });
+    }
+
+    // Write record i in the text format
+    std::ostream& write(std::ostream& os, std::size_t i) const {
+        for (const auto& step : plan_) {
+            Alternatives::write[step.index](os, record(i) + step.offset);
+        }
+        return os;
+    }
+
+    std::ostream& writeBinary(std::ostream& os, std::size_t i) const {
+        for (const auto& step : plan_) {
+            Alternatives::writeBinary[step.index](
+                os, record(i) + step.offset);
+        }
+        return os;
+    }
+
+    // Get the value of the field with the given path in record i
+    // throws std::out_of_range if there is no such field, and
+    // std::bad_variant_access if the field is not of type T
+    template <typename T>
+    const T& get(std::size_t i, std::string_view path) const {
+        const auto& field = type_->layout()->fields.at(path);
+        if (field.index != R::BasicType::template indexOf<T>()) {
+            throw std::bad_variant_access();
+        }
+        return *std::launder(
+            reinterpret_cast<const T*>(record(i) + field.offset));
+    }
+
+    template <typename T>
+    const T& get(std::size_t i, const FieldHandle<T>& handle) const {
+        return *std::launder(
+            reinterpret_cast<const T*>(record(i) + handle.offset));
+    }
+
+    const CompoundType& type() const {
+        return *type_;
     }
 };
 
-template <typename R> class CompoundInstance : public detail::TypeInstance {
-    using member_type = std::unique_ptr<detail::TypeInstance>;
-    using container_type = detail::OrderPreservingMap<std::string, member_type>;
+// Records of one CompoundType stored column-wise, with each basic field
+// of the layout, including those of nested compounds, in its own
+// contiguous std::vector. Scanning one field across every record reads
+// a single array rather than chasing a pointer per record.
+template <typename R> class ColumnBatch {
     using Resolver = R;
-    const CompoundType& type_;
-    container_type members_;
+    using Alternatives = typename R::BasicType::Alternatives;
+    using Columns = detail::ColumnOf<typename R::BasicType::Types>;
+    using Column = typename Columns::type;
+
+    const CompoundType* type_;
+    // Keyed by the dotted path of the field, in the layout's order
+    detail::OrderPreservingMap<std::string,
+        Column,
+        detail::StringHash,
+        std::equal_to<>>
+        columns_;
+    std::size_t size_ = 0;
+
+    // Drop every row from n onwards
+    void truncate(std::size_t n) noexcept {
+        for (auto& c : columns_) {
+            std::visit(
+                [n](auto& col) {
+                    col.erase(std::begin(col) + n, std::end(col));
+                },
+                c.second);
+        }
+    }
+
+    // Append up to n rows, stopping early if the input fails or a row
+    // reads nothing, as RecordBatch does. op reads a value of any
+    // alternative.
+    template <typename Input, typename Op>
+    std::size_t readWith(Input& in, std::size_t n, Op op) {
+        bool mayReadNothing = std::none_of(std::begin(columns_),
+            std::end(columns_),
+            [](const auto& c) {
+                return Alternatives::singleToken[c.second.index()];
+            });
+        std::size_t count = 0;
+        for (; count < n; ++count) {
+            auto start = mayReadNothing ? detail::readPosition(in) : -1;
+            try {
+                for (auto& c : columns_) {
+                    std::visit(
+                        [&](auto& col) {
+                            // Reading into a local rather than col.back()
+                            // also works for std::vector<bool>
+                            using T = typename std::decay_t<decltype(
+                                col)>::value_type;
+                            T v{};
+                            op(in, v);
+                            col.push_back(std::move(v));
+                        },
+                        c.second);
+                }
+            } catch (...) {
+                truncate(size_);
+                throw;
+            }
+            if (!in || columns_.empty() ||
+                (start != -1 && detail::readPosition(in) == start)) {
+                truncate(size_);
+                break;
+            }
+            ++size_;
+        }
+        return count;
+    }
 
 public:
-    CompoundInstance(const std::string& type, std::istream& is)
-        : type_(Resolver::resolveCompound(type)) {
-        read(is);
+    explicit ColumnBatch(const CompoundType& type)
+        : type_(&detail::requireLayout(type)) {
+        const auto& fields = type.layout()->fields;
+        columns_.reserve(fields.size());
+        for (const auto & [ path, field ] : fields) {
+            columns_.emplace(path, Columns::make(field.index));
+        }
     }
 
-    constexpr explicit CompoundInstance(const detail::TypeInstance& rhs)
-        : CompoundInstance(dynamic_cast<const CompoundInstance<R>&>(rhs)) {
+    explicit ColumnBatch(std::string_view type)
+        : ColumnBatch(Resolver::resolveCompound(type)) {
     }
 
-    constexpr CompoundInstance(const CompoundInstance<R>& rhs)
-        : type_(rhs.type_) {
-        for (const auto & [ name, m ] : rhs.members_) {
-            if (auto mPtr = dynamic_cast<typename R::BasicType*>(m.get())) {
-                members_.emplace(
-                    name, std::make_unique<typename R::BasicType>(*mPtr));
-            } else if (auto mPtr =
-                           dynamic_cast<CompoundInstance<R>*>(m.get())) {
-                members_.emplace(
-                    name, std::make_unique<CompoundInstance<R>>(*mPtr));
+    // Number of rows
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    void reserve(std::size_t n) {
+        for (auto& c : columns_) {
+            std::visit([n](auto& col) { col.reserve(n); }, c.second);
+        }
+    }
+
+    void clear() noexcept {
+        truncate(0);
+        size_ = 0;
+    }
+
+    // Append up to n rows read from the text format, returning how many
+    // were read. Input is either a std::istream or a TextScanner.
+    template <typename Input>
+    std::size_t read(Input& in,
+        std::size_t n = std::numeric_limits<std::size_t>::max()) {
+        return readWith(in, n, [](Input& is, auto& v) {
+            if constexpr (std::is_same_v<Input, TextScanner>) {
+                detail::scan(is, v);
             } else {
-                throw std::runtime_error("No such type");
+                is >> v;
             }
+        });
+    }
+
+    std::size_t read(
+        std::istream& is, std::size_t n, BinaryFormat /*unused*/) {
+        return readWith(is, n, [](std::istream& in, auto& v) {
+            detail::readBinary(in, v);
+        });
+    }
+
+    // Write row i in the text format
+    std::ostream& write(std::ostream& os, std::size_t i) const {
+        for (const auto& c : columns_) {
+            std::visit([&os, i](const auto& col) { os << col[i]; }, c.second);
         }
+        return os;
     }
 
-    constexpr CompoundInstance& operator=(
-        const CompoundInstance& /*unused*/) = default;
+    // Every value of the field with the given path, in row order
+    // throws std::out_of_range if there is no such field, and
+    // std::bad_variant_access if the field is not of type T
+    template <typename T>
+    const std::vector<T>& column(std::string_view path) const {
+        return std::get<std::vector<T>>(columns_.at(path));
+    }
 
-    CompoundInstance(CompoundInstance&& /*unused*/) noexcept = default;
+    const CompoundType& type() const {
+        return *type_;
+    }
+};
 
-    CompoundInstance& operator=(
-        CompoundInstance&& /*unused*/) noexcept = default;
+// Incremental decoder for the text format of one CompoundType, for input
+// that arrives in chunks of any size, such as from a socket. Each call
+// to feed() parses the tokens completed by the chunk into the current
+// record, remembering which field of the layout comes next, so records
+// may straddle chunks at any point including inside nested compounds.
+// Only a token cut by the end of a chunk is copied, to be completed by
+// the next one. Finished records are queued as FlatInstances for pop().
+// Each field is parsed from within a single token, so every field must
+// read at most one token, as numbers, strings and empty types do. A type
+// whose operator>> reads several, e.g. a pair, fails to parse here even
+// though it reads from a stream, and so does a token that no field
+// reads.
+template <typename R> class RecordParser {
+    using Resolver = R;
+    using Alternatives = typename R::BasicType::Alternatives;
 
-    ~CompoundInstance() override = default;
+    const CompoundType* type_;
+    std::vector<detail::FieldStep> plan_;
+    std::size_t next_ = 0;
+    std::optional<FlatInstance<R>> current_;
+    std::string partial_;
+    std::deque<FlatInstance<R>> ready_;
+    bool fail_ = false;
 
-    std::ostream& write(std::ostream& os) const override {
-        for (const auto& m : members_) {
-            m.second->write(os);
+    // Parse fields from a whole token. Values that end before the token
+    // does leave the rest for the following fields, as with a stream.
+    void parse(std::string_view token) {
+        // Fields that consume nothing, e.g. an empty type, must not
+        // complete records forever
+        std::size_t idle = 0;
+        while (!fail_ && !token.empty()) {
+            if (idle > plan_.size() || plan_.empty()) {
+                // No field reads the rest of the token
+                fail_ = true;
+                return;
+            }
+            if (!current_) {
+                current_.emplace(FlatInstance<R>(*type_));
+            }
+            const auto& step = plan_[next_];
+            TextScanner s(token);
+            Alternatives::scan[step.index](
+                s, current_->data_.get() + step.offset);
+            if (s.fail()) {
+                fail_ = true;
+                return;
+            }
+            idle = s.remaining().size() == token.size() ? idle + 1 : 0;
+            token = s.remaining();
+            advance();
         }
-        return os;
+        drain();
     }
 
-    std::istream& read(std::istream& is) override {
-        for (const auto & [ name, member ] : type_.members()) {
-            if (R::isBasicType(member.type)) {
-                members_[name] = std::make_unique<typename R::BasicType>(
-                    R::resolveBasic(member.type)(is));
-            } else if (R::isCompoundType(member.type)) {
-                members_[name] = std::make_unique<CompoundInstance<R>>(
-                    R::resolveCompound(member.type).template create<R>(is));
-            } else {
-                throw std::runtime_error("No such type: " + member.type);
+    // Move on to the next field, queueing the record if it is finished
+    void advance() {
+        if (++next_ == plan_.size()) {
+            ready_.push_back(std::move(*current_));
+            current_.reset();
+            next_ = 0;
+        }
+    }
+
+    // Parse the remaining fields of the current record that read nothing
+    // from an empty input, e.g. trailing empty types, as a stream at its
+    // end would. Otherwise a record ending in such fields would wait for
+    // a token that belongs to the next record. A field that needs a token
+    // stops this without failing.
+    void drain() {
+        while (!fail_ && current_) {
+            const auto& step = plan_[next_];
+            if (Alternatives::singleToken[step.index]) {
+                return;
+            }
+            TextScanner s{std::string_view()};
+            Alternatives::scan[step.index](
+                s, current_->data_.get() + step.offset);
+            if (s.fail()) {
+                return;
             }
+            advance();
         }
-        return is;
     }
 
-    const detail::TypeInstance& operator()(
-        const std::string& name) const override {
-        return *members_.at(name);
+public:
+    explicit RecordParser(const CompoundType& type)
+        : type_(&detail::requireLayout(type)),
+          plan_(detail::planFields(*type.layout())) {
     }
 
-    template <typename T> const T& get(const std::string& name) const {
-        return dynamic_cast<const typename R::BasicType&>(*members_.at(name))
-            .template get<T>();
+    explicit RecordParser(std::string_view type)
+        : RecordParser(Resolver::resolveCompound(type)) {
+    }
+
+    // Parse as much of the chunk as possible. The chunk need not outlive
+    // the call.
+    void feed(std::string_view chunk) {
+        if (fail_) {
+            return;
+        }
+        if (!partial_.empty()) {
+            auto n = static_cast<std::size_t>(
+                std::find_if(std::begin(chunk), std::end(chunk),
+                    [](char c) {
+                        return detail::isSpace(static_cast<unsigned char>(c));
+                    }) -
+                std::begin(chunk));
+            partial_.append(chunk.data(), n);
+            if (n == chunk.size()) {
+                return;
+            }
+            parse(partial_);
+            partial_.clear();
+            chunk.remove_prefix(n);
+        }
+        TextScanner s(chunk);
+        for (auto token = s.next(); !token.empty(); token = s.next()) {
+            // A token reaching the end of the chunk may continue
+            if (s.remaining().empty()) {
+                partial_.assign(token.data(), token.size());
+                return;
+            }
+            parse(token);
+        }
+    }
+
+    // Signal the end of the input, completing a final token that was
+    // not followed by whitespace
+    void finish() {
+        if (!fail_ && !partial_.empty()) {
+            parse(partial_);
+        }
+        partial_.clear();
+    }
+
+    // Number of finished records waiting to be popped
+    std::size_t available() const noexcept {
+        return ready_.size();
+    }
+
+    // Take the oldest finished record
+    // throws std::out_of_range if there is none
+    FlatInstance<R> pop() {
+        if (ready_.empty()) {
+            throw std::out_of_range("RecordParser::pop");
+        }
+        FlatInstance<R> x(std::move(ready_.front()));
+        ready_.pop_front();
+        return x;
     }
 
-    const CompoundInstance<R>& get(const std::string& name) const {
-        return dynamic_cast<const CompoundInstance<R>&>(*members_.at(name));
+    // True if part of a record has been parsed but not finished
+    bool inRecord() const noexcept {
+        return current_.has_value() || !partial_.empty();
+    }
+
+    // True if a value could not be parsed, after which input is ignored
+    bool fail() const noexcept {
+        return fail_;
+    }
+
+    explicit operator bool() const noexcept {
+        return !fail_;
     }
 
     const CompoundType& type() const {
-        return type_;
+        return *type_;
     }
 };
 
+// Decode the records of one CompoundType in the text format from a
+// buffer on several threads, returning one batch per thread in input
+// order. The text has no record delimiters, so records are found by
+// counting tokens, which requires every field to be a single token as
+// the built-in numbers and strings are; other types are decoded on the
+// calling thread. The buffer is cut into equal byte ranges, the tokens
+// in each are counted in parallel from SIMD whitespace masks, and each
+// thread then decodes the records starting in its range. Decoding stops
+// at the first record that fails to parse, as reading sequentially
+// would.
 template <typename R>
-std::ostream& operator<<(std::ostream& os, const CompoundInstance<R>& x) {
+std::vector<RecordBatch<R>> decodeParallel(const CompoundType& type,
+    std::string_view text,
+    unsigned threads = std::thread::hardware_concurrency()) {
+    using Alternatives = typename R::BasicType::Alternatives;
+    RecordBatch<R> first(type);
+    const auto& layout = *type.layout();
+    std::size_t fields = layout.fields.size();
+    bool countable = std::all_of(std::begin(layout.fields),
+        std::end(layout.fields),
+        [](const auto& f) {
+            return Alternatives::singleToken[f.second.index];
+        });
+    threads = std::max(threads, 1U);
+    if (fields == 0 || !countable || threads == 1 ||
+        text.size() < threads * 4096) {
+        TextScanner s(text);
+        first.read(s);
+        std::vector<RecordBatch<R>> batches;
+        batches.push_back(std::move(first));
+        return batches;
+    }
+
+    // Range boundaries, moved forward onto whitespace so that no token
+    // is split between ranges
+    std::vector<std::size_t> bounds(threads + 1, text.size());
+    bounds[0] = 0;
+    for (unsigned i = 1; i < threads; ++i) {
+        auto pos = std::max(text.size() / threads * i, bounds[i - 1]);
+        while (pos < text.size() &&
+               !detail::isSpace(static_cast<unsigned char>(text[pos]))) {
+            ++pos;
+        }
+        bounds[i] = pos;
+    }
+
+    auto parallel = [threads](auto op) {
+        std::vector<std::future<decltype(op(0U))>> futures;
+        futures.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i) {
+            futures.push_back(std::async(std::launch::async, op, i));
+        }
+        std::vector<decltype(op(0U))> results;
+        results.reserve(threads);
+        for (auto& f : futures) {
+            results.push_back(f.get());
+        }
+        return results;
+    };
+
+    auto counts = parallel([&](unsigned i) {
+        return detail::countTokens(
+            text.data() + bounds[i], text.data() + bounds[i + 1]);
+    });
+
+    // Tokens before each range, and so which records start in it
+    std::vector<std::size_t> before(threads + 1, 0);
+    for (unsigned i = 0; i < threads; ++i) {
+        before[i + 1] = before[i] + counts[i];
+    }
+    auto firstRecord = [&](unsigned i) {
+        return (before[i] + fields - 1) / fields;
+    };
+
+    auto batches = parallel([&](unsigned i) {
+        RecordBatch<R> batch(type);
+        auto n = firstRecord(i + 1) - firstRecord(i);
+        if (n == 0) {
+            return batch;
+        }
+        // Skip the tail of the record that started in an earlier range
+        TextScanner s(text.substr(bounds[i]));
+        for (auto skip = firstRecord(i) * fields - before[i]; skip > 0;
+             --skip) {
+            s.next();
+        }
+        batch.reserve(n);
+        batch.read(s, n);
+        return batch;
+    });
+
+    // Drop everything after a batch that stopped early. Batches cannot
+    // be move-assigned, so erase is unavailable.
+    for (unsigned i = 0; i < threads; ++i) {
+        if (batches[i].size() != firstRecord(i + 1) - firstRecord(i)) {
+            while (batches.size() > i + 1) {
+                batches.pop_back();
+            }
+            break;
+        }
+    }
+    return batches;
+}
+
+template <typename R>
+std::vector<RecordBatch<R>> decodeParallel(std::string_view type,
+    std::string_view text,
+    unsigned threads = std::thread::hardware_concurrency()) {
+    return decodeParallel<R>(R::resolveCompound(type), text, threads);
+}
+
+template <typename R>
+std::ostream& operator<<(std::ostream& os, const FlatInstance<R>& x) {
     return x.write(os);
 }
 
 template <typename R>
-std::istream& operator>>(std::istream& is, CompoundInstance<R>& x) {
+std::istream& operator>>(std::istream& is, FlatInstance<R>& x) {
     return x.read(is);
 }
 
+template <typename R>
+TextScanner& operator>>(TextScanner& s, FlatInstance<R>& x) {
+    return x.read(s);
+}
+
 // If B is a Basic<R, U...>, then construct a type map mapping the given
 // types to the U...
 template <typename B>
@@ -636,7 +3981,274 @@ inline TypeMap_t<B> makeTypeMap(std::list<std::string> types) {
         typename B::Types(), types);
 }
 
-// Example implementation of a type resolver. Uses static variables
+template <typename... U> class BasicResolver;
+
+// Resolver held as an ordinary object, so that a process can keep
+// several independent sets of compound types over the same basic types,
+// e.g. one per tenant, without contending on or polluting a shared
+// table. Types registered here are instantiated as CompoundInstance<R>
+// or FlatInstance<R> for R = TypeRegistry<U...>::Resolver, by passing
+// the type from resolveCompound; nested members are then resolved
+// through this registry. Nothing static is involved, so BasicResolver
+// need not be specialized. The registry must outlive the types and
+// instances obtained from it.
+//
+// Names are published as immutable snapshots through an atomic pointer,
+// so that lookups neither lock nor write shared memory. Writers copy the
+// current snapshot under a mutex, change the copy and swap it in, unless
+// there is nothing to change. Readers do not announce when they are done
+// with a snapshot, so replaced ones are kept until the registry is
+// destroyed; there is one per registration or newly interned name.
+// Compound types live in a map whose nodes never move, and are only
+// published once their layout is computed. Instances of types with a
+// layout resolve their members from it, without reading a snapshot.
+template <typename... U> class TypeRegistry {
+public:
+    using BasicType = Basic<BasicResolver<U...>, U...>;
+    using BasicMapType = TypeMap_t<BasicType>;
+    using CompoundMapType = std::unordered_map<std::string, CompoundType>;
+
+    // Resolver to instantiate registered types with. They resolve their
+    // members through the registry they were registered with, so this
+    // has no types of its own: it only names the Basic.
+    struct Resolver {
+        using BasicType = TypeRegistry::BasicType;
+
+        static TypeDescriptor describe(const CompoundType::Member& /*unused*/) {
+            return TypeDescriptor{};
+        }
+
+        // throws std::out_of_range, as there are no types to look up
+        static const CompoundType& resolveCompound(std::string_view s) {
+            throw std::out_of_range(
+                "No such compound type: " + std::string(s));
+        }
+    };
+
+private:
+    // Interning table giving every type name a TypeId, and describing
+    // the type with each id. Basic types are interned on construction,
+    // and other names as they are registered or referred to by a
+    // registered compound type, which need not have been registered yet.
+    // Names are looked up transparently, so that callers holding a
+    // std::string_view or a literal need not construct a std::string.
+    // The basic types are interned first, so the id of a basic type is
+    // also its position in basics.
+    struct Names {
+        detail::CompactOrderPreservingMap<std::string,
+            TypeId,
+            detail::StringHash,
+            std::equal_to<>>
+            ids;
+        std::vector<TypeDescriptor> types;
+        std::vector<const typename BasicMapType::mapped_type*> basics;
+
+        TypeDescriptor describe(std::string_view s) const {
+            auto it = ids.find(s);
+            return it == std::end(ids) ? TypeDescriptor{} : types[it->second];
+        }
+
+        TypeDescriptor describe(TypeId id) const {
+            return id < types.size() ? types[id] : TypeDescriptor{};
+        }
+
+        // Members not interned here, including those with noTypeId, are
+        // looked up by name
+        TypeDescriptor describe(const CompoundType::Member& m) const {
+            return m.id < types.size() ? types[m.id] : describe(m.type);
+        }
+
+        TypeId intern(std::string_view s) {
+            auto it = ids.find(s);
+            if (it != std::end(ids)) {
+                return it->second;
+            }
+            types.emplace_back();
+            try {
+                ids.emplace(std::string(s), types.size() - 1);
+            } catch (...) {
+                types.pop_back();
+                throw;
+            }
+            return types.size() - 1;
+        }
+    };
+
+    // Names being changed by a writer, which a CompoundType being
+    // registered interns its names with and resolves its members through
+    struct Draft {
+        using BasicType = TypeRegistry::BasicType;
+        Names& names;
+
+        TypeId intern(std::string_view s) {
+            return names.intern(s);
+        }
+
+        TypeDescriptor describe(const CompoundType::Member& m) const {
+            return names.describe(m);
+        }
+    };
+
+    const BasicMapType basicTypes_;
+    CompoundMapType compoundTypes_;
+    std::atomic<const Names*> current_;
+    std::mutex mutex_;
+    // Every snapshot published, the last being current_
+    std::vector<std::unique_ptr<const Names>> versions_;
+
+    const Names& names() const {
+        return *current_.load(std::memory_order_acquire);
+    }
+
+    // Swap in a new snapshot. The caller holds mutex_.
+    void publish(std::unique_ptr<Names> next) {
+        versions_.push_back(std::move(next));
+        current_.store(versions_.back().get(), std::memory_order_release);
+    }
+
+    static TypeDescriptor describeMember(
+        const void* registry, const CompoundType::Member& m) {
+        return static_cast<const TypeRegistry*>(registry)->describe(m);
+    }
+
+public:
+    explicit TypeRegistry(BasicMapType basicTypes)
+        : basicTypes_(std::move(basicTypes)) {
+        auto n = std::make_unique<Names>();
+        for (const auto & [ name, entry ] : basicTypes_) {
+            n->ids.emplace(name, n->types.size());
+            n->types.push_back(TypeDescriptor{
+                TypeDescriptor::Kind::Basic, entry.index, nullptr});
+            n->basics.push_back(&entry);
+        }
+        publish(std::move(n));
+    }
+
+    TypeRegistry(const TypeRegistry& /*unused*/) = delete;
+
+    TypeRegistry& operator=(const TypeRegistry& /*unused*/) = delete;
+
+    // throws std::out_of_range if s is not a basic type
+    const auto& resolveBasic(std::string_view s) const {
+        const auto& n = names();
+        auto it = n.ids.find(s);
+        if (it == std::end(n.ids) || it->second >= n.basics.size()) {
+            throw std::out_of_range("No such basic type: " + std::string(s));
+        }
+        return *n.basics[it->second];
+    }
+
+    // Get the id of the type name s, assigning a new one if s has not
+    // been seen before
+    TypeId intern(std::string_view s) {
+        const auto& n = names();
+        auto it = n.ids.find(s);
+        if (it != std::end(n.ids)) {
+            return it->second;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Another thread may have interned s while we waited
+        const auto& current = *versions_.back();
+        it = current.ids.find(s);
+        if (it != std::end(current.ids)) {
+            return it->second;
+        }
+        auto next = std::make_unique<Names>(current);
+        auto id = next->intern(s);
+        publish(std::move(next));
+        return id;
+    }
+
+    // Find out what kind of type s is, returning a descriptor with kind
+    // None if there is no such type
+    TypeDescriptor describe(std::string_view s) const {
+        return names().describe(s);
+    }
+
+    // As above, for an id returned by intern
+    TypeDescriptor describe(TypeId id) const {
+        return names().describe(id);
+    }
+
+    // Describe the type of a member, by id if it has been interned
+    TypeDescriptor describe(const CompoundType::Member& m) const {
+        return names().describe(m);
+    }
+
+    // Register a new compound type and compute its layout, unless a
+    // compound type with the same name already exists. Types registered
+    // earlier that refer to it, directly or through other types, get a
+    // layout once all of their members have one. Safe to call while
+    // other threads resolve types: they see either none or all of the
+    // registration, and each layout only once it is complete.
+    void registerCompoundType(CompoundType type) {
+        if (isBasicType(type.name())) {
+            throw std::runtime_error(
+                "Cannot register a Compound with the same name as a Basic");
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto[it, inserted] = compoundTypes_.emplace(type.name(), type);
+        if (!inserted) {
+            return;
+        }
+        try {
+            auto next = std::make_unique<Names>(*versions_.back());
+            auto& registered = it->second;
+            Draft draft{*next};
+            registered.internNames(draft, this, &describeMember);
+            next->types[registered.id()] = TypeDescriptor{
+                TypeDescriptor::Kind::Compound, 0, &registered};
+            registered.computeLayout(draft);
+            publish(std::move(next));
+        } catch (...) {
+            compoundTypes_.erase(it);
+            throw;
+        }
+        if (!it->second.layout()) {
+            return;
+        }
+        // Repeat until nothing changes, as each new layout may complete
+        // types that refer to it in turn
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (auto& entry : compoundTypes_) {
+                if (!entry.second.layout()) {
+                    entry.second.computeLayout(*this);
+                    changed = changed || entry.second.layout();
+                }
+            }
+        }
+    }
+
+    // throws std::out_of_range if s is not a registered compound type
+    const CompoundType& resolveCompound(std::string_view s) const {
+        auto type = describe(s);
+        if (type.kind != TypeDescriptor::Kind::Compound) {
+            throw std::out_of_range(
+                "No such compound type: " + std::string(s));
+        }
+        return *type.compound;
+    }
+
+    bool isBasicType(std::string_view s) const {
+        return describe(s).kind == TypeDescriptor::Kind::Basic;
+    }
+
+    bool isCompoundType(std::string_view s) const {
+        return describe(s).kind == TypeDescriptor::Kind::Compound;
+    }
+
+    // Instantiate a registered type by name. Input is either a
+    // std::istream or a TextScanner, and Format is empty for the text
+    // format or BinaryFormat.
+    template <typename Input, typename... Format>
+    CompoundInstance<Resolver> create(
+        std::string_view type, Input& in, Format... format) const {
+        return CompoundInstance<Resolver>(resolveCompound(type), in, format...);
+    }
+};
+
+// Example implementation of a type resolver. Uses a static variable
 // that must be explicitly specialized by the user. It is
 // convenient to use the BasicWithDefaultResolver alias to save
 // duplicating template parameters. For example,
@@ -645,49 +4257,69 @@ inline TypeMap_t<B> makeTypeMap(std::list<std::string> types) {
 //     using BR = B::Resolver;
 //     template <>
 //     const BR::BasicMapType BR::basicTypes = makeTypeMap<B>({"int",
-//     "double"}); template <> BR::CompoundMapType BR::compoundTypes =
-//     {};
+//     "double"});
 //
+// Every function forwards to a single TypeRegistry built from
+// basicTypes, which holds the registered compound types itself;
+// construct a TypeRegistry directly for separate registries.
 template <typename... U> class BasicResolver {
 public:
     using BasicType = Basic<BasicResolver<U...>, U...>;
     using BasicMapType = TypeMap_t<BasicType>;
-    using CompoundMapType = std::unordered_map<std::string, CompoundType>;
 
 private:
     const static BasicMapType basicTypes;
-    static CompoundMapType compoundTypes;
 
 public:
-    constexpr static auto resolveBasic(const std::string& s) {
-        return basicTypes.at(s);
+    // The registry behind the static functions
+    static TypeRegistry<U...>& registry() {
+        static TypeRegistry<U...> r(basicTypes);
+        return r;
+    }
+
+    // throws std::out_of_range if s is not a basic type
+    constexpr static const auto& resolveBasic(std::string_view s) {
+        return registry().resolveBasic(s);
+    }
+
+    // Get the id of the type name s, assigning a new one if s has not
+    // been seen before
+    static TypeId intern(std::string_view s) {
+        return registry().intern(s);
+    }
+
+    // Find out what kind of type s is, returning a descriptor with kind
+    // None if there is no such type
+    static TypeDescriptor describe(std::string_view s) {
+        return registry().describe(s);
     }
 
+    static TypeDescriptor describe(TypeId id) {
+        return registry().describe(id);
+    }
+
+    // Describe the type of a member, by id if it has been interned
+    static TypeDescriptor describe(const CompoundType::Member& m) {
+        return registry().describe(m);
+    }
+
+    // Register a new compound type and compute its layout, unless a
+    // compound type with the same name already exists
     static void registerCompoundType(CompoundType type) {
-        if (!isBasicType(type.name())) {
-            compoundTypes.emplace(type.name(), type);
-        } else {
-            throw std::runtime_error(
-                "Cannot register a Compound with the same name as a Basic");
-        }
+        registry().registerCompoundType(std::move(type));
     }
 
-    constexpr static const CompoundType& resolveCompound(const std::string& s) {
-        return compoundTypes.at(s);
+    // throws std::out_of_range if s is not a registered compound type
+    constexpr static const CompoundType& resolveCompound(std::string_view s) {
+        return registry().resolveCompound(s);
     }
 
-    constexpr static bool isBasicType(const std::string& s) {
-        return std::end(basicTypes) !=
-               std::find_if(std::begin(basicTypes),
-                   std::end(basicTypes),
-                   [&s](const auto& p) { return p.first == s; });
+    static bool isBasicType(std::string_view s) {
+        return registry().isBasicType(s);
     }
 
-    constexpr static bool isCompoundType(const std::string& s) {
-        return std::end(compoundTypes) !=
-               std::find_if(std::begin(compoundTypes),
-                   std::end(compoundTypes),
-                   [&s](const auto& p) { return p.first == s; });
+    static bool isCompoundType(std::string_view s) {
+        return registry().isCompoundType(s);
     }
 };
 
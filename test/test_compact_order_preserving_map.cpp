@@ -0,0 +1,156 @@
+#include "catch.hpp"
+#include "runtype.hpp"
+#include <string>
+#include <vector>
+
+using namespace runtype;
+using CompactMap = detail::CompactOrderPreservingMap<std::string, int>;
+
+namespace {
+// Key which counts how often it is copied
+struct CountedKey {
+    static int copies;
+    int value;
+
+    explicit CountedKey(int v) : value(v) {
+    }
+    CountedKey(const CountedKey& rhs) : value(rhs.value) {
+        ++copies;
+    }
+    CountedKey(CountedKey&& rhs) noexcept = default;
+    CountedKey& operator=(const CountedKey& /*unused*/) = default;
+    CountedKey& operator=(CountedKey&& /*unused*/) noexcept = default;
+
+    bool operator==(const CountedKey& rhs) const {
+        return value == rhs.value;
+    }
+};
+
+int CountedKey::copies = 0;
+
+struct CountedKeyHash {
+    std::size_t operator()(const CountedKey& k) const {
+        return std::hash<int>()(k.value);
+    }
+};
+} // namespace
+
+TEST_CASE("Is selectable by storage", "[CompactOrderPreservingMap]") {
+    using Node = detail::BasicOrderPreservingMap<detail::MapStorage::Node,
+        std::string,
+        int>;
+    using Compact =
+        detail::BasicOrderPreservingMap<detail::MapStorage::Compact,
+            std::string,
+            int>;
+    using StringIntMap = detail::OrderPreservingMap<std::string, int>;
+    REQUIRE((std::is_same_v<Node, StringIntMap>));
+    REQUIRE((std::is_same_v<Compact, CompactMap>));
+}
+
+TEST_CASE("Compact map is constructible and queryable",
+    "[CompactOrderPreservingMap]") {
+    CompactMap empty;
+    REQUIRE(empty.empty());
+    REQUIRE(empty.size() == 0);
+    REQUIRE_THROWS_AS(empty.at("a"), std::out_of_range);
+
+    CompactMap opm({{"z", 1}, {"a", 4}, {"p", 3}});
+    REQUIRE(opm.size() == 3);
+    REQUIRE(opm.at("z") == 1);
+    REQUIRE(opm.at("a") == 4);
+    REQUIRE(opm.at("p") == 3);
+    REQUIRE(opm.nth(1)->first == "a");
+
+    opm.clear();
+    REQUIRE(opm.empty());
+    REQUIRE_THROWS_AS(opm.at("a"), std::out_of_range);
+}
+
+TEST_CASE("Compact map reinsertion should not modify",
+    "[CompactOrderPreservingMap]") {
+    CompactMap opm({{"a", 1}});
+
+    REQUIRE_FALSE(opm.insert({"a", 2}).second);
+    REQUIRE_FALSE(opm.emplace("a", 2).second);
+    REQUIRE_FALSE(opm.try_emplace("a", 2).second);
+    REQUIRE(opm.at("a") == 1);
+    REQUIRE(opm.size() == 1);
+
+    opm["a"] = 7;
+    REQUIRE(opm.at("a") == 7);
+    opm["b"] = 8;
+    REQUIRE(opm.at("b") == 8);
+}
+
+TEST_CASE("Compact map iterates in insertion order while growing",
+    "[CompactOrderPreservingMap]") {
+    CompactMap opm;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 1000; ++i) {
+        // Insert in an order unrelated to the hashes
+        auto key = std::to_string((i * 7919) % 1000);
+        expected.push_back(key);
+        REQUIRE(opm.try_emplace(key, i).second);
+    }
+    REQUIRE(opm.size() == 1000);
+
+    std::vector<std::string> output;
+    for (const auto& p : opm) {
+        output.push_back(p.first);
+    }
+    REQUIRE(output == expected);
+    REQUIRE(opm.at(expected[500]) == 500);
+
+    CompactMap copy;
+    copy = opm;
+    REQUIRE(copy == opm);
+    REQUIRE(copy.at(expected[999]) == 999);
+    copy["new"] = 1;
+    REQUIRE(copy != opm);
+}
+
+TEST_CASE("Compact map can reserve", "[CompactOrderPreservingMap]") {
+    CompactMap opm;
+    opm.reserve(1000);
+    auto buckets = opm.bucket_count();
+    REQUIRE(buckets * opm.max_load_factor() >= 1000);
+    for (int i = 0; i < 1000; ++i) {
+        opm.emplace(std::to_string(i), i);
+    }
+    REQUIRE(opm.bucket_count() == buckets);
+    REQUIRE(opm.find("999")->second == 999);
+
+    opm.shrink_to_fit();
+    REQUIRE(opm.load_factor() <= opm.max_load_factor());
+    REQUIRE(opm.at("500") == 500);
+}
+
+TEST_CASE("Compact map moves entries when it grows",
+    "[CompactOrderPreservingMap]") {
+    detail::CompactOrderPreservingMap<CountedKey, std::string, CountedKeyHash>
+        opm;
+    CountedKey::copies = 0;
+    for (int i = 0; i < 1000; ++i) {
+        opm.try_emplace(CountedKey(i), std::to_string(i));
+    }
+    REQUIRE(CountedKey::copies == 0);
+    REQUIRE(opm.at(CountedKey(999)) == "999");
+
+    // Keys are const through the iterators
+    REQUIRE((std::is_const_v<
+        std::remove_reference_t<decltype(opm.begin()->first)>>));
+    const auto& view = opm;
+    REQUIRE(opm.begin() == view.begin());
+    REQUIRE(view.end() - opm.begin() == 1000);
+    REQUIRE(opm.nth(500)->second == "500");
+
+    // Values can be changed through the proxies the iterators return
+    for (const auto & [ key, value ] : opm) {
+        value = std::to_string(key.value + 1);
+    }
+    opm.begin()->second += "!";
+    REQUIRE(opm.at(CountedKey(0)) == "1!");
+    std::pair<const CountedKey, std::string> entry = *opm.nth(1);
+    REQUIRE(entry.second == "2");
+}
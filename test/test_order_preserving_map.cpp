@@ -1,5 +1,6 @@
 #include "catch.hpp"
 #include "runtype.hpp"
+#include <memory_resource>
 
 using namespace runtype;
 using StringIntMap = detail::OrderPreservingMap<std::string, int>;
@@ -101,3 +102,193 @@ TEST_CASE("Iteration should be in insertion order", "[OrderPreservingMap]") {
     }
     REQUIRE(output == expected);
 }
+
+TEST_CASE("Uses the given allocator", "[OrderPreservingMap]") {
+    using PmrMap = detail::OrderPreservingMap<std::string,
+        int,
+        std::hash<std::string>,
+        std::equal_to<std::string>,
+        std::pmr::polymorphic_allocator<std::pair<const std::string, int>>>;
+    std::pmr::monotonic_buffer_resource arena;
+    PmrMap opm(&arena);
+    opm.emplace("z", 1);
+    opm.emplace("a", 4);
+    REQUIRE(opm.get_allocator().resource() == &arena);
+    REQUIRE(opm.at("a") == 4);
+
+    PmrMap copy(opm);
+    REQUIRE(copy.get_allocator().resource() != &arena);
+    REQUIRE(copy == opm);
+
+    PmrMap moved;
+    moved = std::move(copy);
+    REQUIRE(moved.at("z") == 1);
+    REQUIRE(std::begin(moved)->first == "z");
+}
+
+TEST_CASE("Assignment preserves order", "[OrderPreservingMap]") {
+    StringIntMap opm({{"z", 1}, {"a", 4}, {"p", 3}});
+    StringIntMap copy;
+    copy = opm;
+    opm.clear();
+    REQUIRE(copy.size() == 3);
+    REQUIRE(std::begin(copy)->first == "z");
+    REQUIRE(copy.at("p") == 3);
+}
+
+TEST_CASE("Insertion returns an iterator to the element",
+    "[OrderPreservingMap]") {
+    StringIntMap opm({{"z", 1}, {"a", 4}, {"p", 3}});
+    auto [it, inserted] = opm.emplace("a", 7);
+    REQUIRE_FALSE(inserted);
+    REQUIRE(it->first == "a");
+    REQUIRE(it->second == 4);
+    REQUIRE((++it)->first == "p");
+
+    for (int i = 0; i < 1000; ++i) {
+        opm.emplace(std::to_string(i), i);
+    }
+    REQUIRE(opm.try_emplace("z").first == std::begin(opm));
+    REQUIRE(opm.nth(500)->second == 497);
+    REQUIRE(opm.at("999") == 999);
+}
+
+TEST_CASE("Can be erased from", "[OrderPreservingMap]") {
+    StringIntMap opm({{"z", 1}, {"a", 4}, {"p", 3}, {"b", 2}});
+    REQUIRE(opm.erase("a") == 1);
+    REQUIRE(opm.erase("a") == 0);
+    REQUIRE(opm.size() == 3);
+    REQUIRE_THROWS_AS(opm.at("a"), std::out_of_range);
+
+    auto it = opm.erase(std::begin(opm));
+    REQUIRE(it->first == "p");
+    REQUIRE(std::begin(opm) == it);
+    opm.emplace("a", 5);
+
+    std::vector<std::pair<std::string, int>> output(
+        std::begin(opm), std::end(opm));
+    std::vector<std::pair<std::string, int>> expected{
+        {"p", 3}, {"b", 2}, {"a", 5}};
+    REQUIRE(output == expected);
+    REQUIRE(opm.nth(1)->first == "b");
+    REQUIRE((--std::end(opm))->first == "a");
+    REQUIRE(opm == StringIntMap({{"p", 3}, {"b", 2}, {"a", 5}}));
+}
+
+TEST_CASE("Erasing the last element returns the end", "[OrderPreservingMap]") {
+    StringIntMap opm({{"a", 1}, {"b", 2}, {"c", 3}});
+    opm.erase("b");
+    // The erased slot before "c" is dropped along with it
+    auto it = opm.erase(opm.nth(1));
+    REQUIRE(it == std::end(opm));
+    REQUIRE(opm.size() == 1);
+    opm.emplace("d", 4);
+    REQUIRE(opm.nth(1)->first == "d");
+    REQUIRE(opm.at("a") == 1);
+}
+
+TEST_CASE("Erasing many elements keeps order", "[OrderPreservingMap]") {
+    StringIntMap opm;
+    for (int i = 0; i < 1000; ++i) {
+        opm.emplace(std::to_string(i), i);
+    }
+    // Erase all but every tenth element
+    for (auto it = std::begin(opm); it != std::end(opm);) {
+        if (it->second % 10 == 0) {
+            ++it;
+        } else {
+            it = opm.erase(it);
+        }
+    }
+    REQUIRE(opm.size() == 100);
+    int expected = 0;
+    for (const auto& p : opm) {
+        REQUIRE(p.second == expected);
+        REQUIRE(opm.at(p.first) == expected);
+        expected += 10;
+    }
+    while (!opm.empty()) {
+        opm.erase(std::begin(opm));
+    }
+    REQUIRE(std::begin(opm) == std::end(opm));
+}
+
+TEST_CASE("Grows beyond inline storage", "[OrderPreservingMap]") {
+    using SmallMap = detail::OrderPreservingMap<std::string,
+        int,
+        std::hash<std::string>,
+        std::equal_to<std::string>,
+        std::allocator<std::pair<const std::string, int>>,
+        2>;
+    SmallMap opm({{"z", 1}, {"a", 4}});
+    opm.emplace("p", 3);
+    opm.emplace("a", 5);
+    REQUIRE(opm.size() == 3);
+    REQUIRE(opm.at("a") == 4);
+    REQUIRE(opm.nth(2)->first == "p");
+
+    SmallMap moved(std::move(opm));
+    REQUIRE(moved.at("z") == 1);
+    REQUIRE(moved.at("p") == 3);
+    REQUIRE(moved.erase("z") == 1);
+    REQUIRE(std::begin(moved)->first == "a");
+
+    opm = std::move(moved);
+    REQUIRE(opm == SmallMap({{"a", 4}, {"p", 3}}));
+    REQUIRE(opm.at("a") == 4);
+
+    // Containers of maps move rather than copy them when they grow
+    REQUIRE(std::is_nothrow_move_constructible_v<SmallMap>);
+    REQUIRE(std::is_nothrow_move_assignable_v<SmallMap>);
+    REQUIRE(std::is_nothrow_move_constructible_v<StringIntMap>);
+}
+
+TEST_CASE("Supports heterogeneous lookup", "[OrderPreservingMap]") {
+    using TransparentMap = detail::OrderPreservingMap<std::string,
+        int,
+        detail::StringHash,
+        std::equal_to<>>;
+    TransparentMap opm({{"z", 1}, {"a", 4}});
+    for (int i = 0; i < 20; ++i) {
+        opm.emplace("key" + std::to_string(i), i);
+    }
+    std::string_view a = "a";
+    REQUIRE(opm.at(a) == 4);
+    REQUIRE(opm.at("key12") == 12);
+    REQUIRE(opm.contains(std::string_view("z")));
+    REQUIRE_FALSE(opm.contains("y"));
+    REQUIRE(opm.find("y") == std::end(opm));
+    REQUIRE(opm.find(a) == opm.nth(1));
+    REQUIRE_THROWS_AS(opm.at(std::string_view("y")), std::out_of_range);
+
+    StringIntMap plain({{"z", 1}});
+    REQUIRE(plain.contains("z"));
+    REQUIRE(plain.find("z")->second == 1);
+}
+
+TEST_CASE("Can reserve and shrink", "[OrderPreservingMap]") {
+    StringIntMap opm({{"z", 1}, {"a", 4}});
+    REQUIRE(opm.bucket_count() == 0);
+    REQUIRE(opm.load_factor() == 0.0f);
+
+    opm.reserve(100);
+    auto buckets = opm.bucket_count();
+    REQUIRE(buckets * opm.max_load_factor() >= 100);
+    for (int i = 0; i < 98; ++i) {
+        opm.emplace(std::to_string(i), i);
+    }
+    REQUIRE(opm.bucket_count() == buckets);
+    REQUIRE(opm.load_factor() <= opm.max_load_factor());
+
+    opm.rehash(4 * buckets);
+    REQUIRE(opm.bucket_count() >= 4 * buckets);
+    REQUIRE(opm.at("50") == 50);
+
+    for (int i = 0; i < 98; ++i) {
+        opm.erase(std::to_string(i));
+    }
+    opm.shrink_to_fit();
+    REQUIRE(opm.bucket_count() == 0);
+    REQUIRE(opm == StringIntMap({{"z", 1}, {"a", 4}}));
+    REQUIRE(opm.at("a") == 4);
+}
@@ -1,8 +1,17 @@
 #include "catch.hpp"
 #include "runtype.hpp"
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory_resource>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <typeinfo>
 
 using namespace runtype;
@@ -24,7 +33,6 @@ using BR = B::Resolver;
 template <>
 const BR::BasicMapType BR::basicTypes = makeTypeMap<B>(
     {"int", "double", "string", "void"});
-template <> BR::CompoundMapType BR::compoundTypes = {};
 
 using B2 = BasicWithDefaultResolver<double, int, float, Blank<1>>;
 using B2R = B2::Resolver;
@@ -183,6 +191,171 @@ TEST_CASE("Can register and lookup compound types",
     }
 }
 
+TEST_CASE("Describes types with one lookup", "[BasicResolver]") {
+    BR::registerCompoundType(TestTypes::multiType);
+
+    auto intType = BR::describe("int");
+    REQUIRE(intType.kind == TypeDescriptor::Kind::Basic);
+    REQUIRE(intType.index == B::indexOf<int>());
+    REQUIRE(BR::describe("string").index == B::indexOf<std::string>());
+
+    auto multiType = BR::describe("multiType");
+    REQUIRE(multiType.kind == TypeDescriptor::Kind::Compound);
+    REQUIRE(multiType.compound == &BR::resolveCompound("multiType"));
+
+    REQUIRE(BR::describe("foo").kind == TypeDescriptor::Kind::None);
+    REQUIRE(BR::describe("").kind == TypeDescriptor::Kind::None);
+}
+
+TEST_CASE("Looks up names from string views", "[BasicResolver]") {
+    BR::registerCompoundType(TestTypes::nestedType);
+    BR::registerCompoundType(TestTypes::multiType);
+
+    std::string buffer = "nestedType int m";
+    std::string_view nestedName(buffer.data(), 10);
+    std::string_view intName(buffer.data() + 11, 3);
+    REQUIRE(BR::isCompoundType(nestedName));
+    REQUIRE(BR::isBasicType(intName));
+    REQUIRE_FALSE(BR::isBasicType(nestedName));
+    REQUIRE(&BR::resolveCompound(nestedName) ==
+        &BR::resolveCompound("nestedType"));
+    REQUIRE_THROWS_AS(BR::resolveCompound(intName), std::out_of_range);
+
+    std::stringstream ss("6 10 3.7 hello world");
+    CompoundInstance<BR> nested(nestedName, ss);
+    REQUIRE(nested.get<int>(std::string_view(buffer).substr(11, 1)) == 6);
+    REQUIRE(nested.get(buffer.substr(15)).get<double>("d") == 3.7);
+}
+
+TEST_CASE("Registers types while others resolve", "[BasicResolver]") {
+    BR::registerCompoundType(TestTypes::multiType);
+    const auto& multi = BR::resolveCompound("multiType");
+
+    // Catch is not thread-safe, so readers only count what goes wrong
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&done, &errors, &multi, t] {
+            for (int i = t; !done; ++i) {
+                if (&BR::resolveCompound("multiType") != &multi) {
+                    ++errors;
+                }
+                // Registered types are only seen once complete
+                auto name = "concurrent" + std::to_string(i % 200);
+                auto type = BR::describe(name);
+                if (type.kind == TypeDescriptor::Kind::Compound &&
+                    !type.compound->layout()) {
+                    ++errors;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 200; ++i) {
+        auto name = "concurrent" + std::to_string(i);
+        BR::registerCompoundType(
+            CompoundType(name, {{"i", {"int"}}, {"m", {"multiType"}}}));
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    REQUIRE(errors == 0);
+    REQUIRE(&BR::resolveCompound("multiType") == &multi);
+    REQUIRE(BR::resolveCompound("concurrent199").layout()->fields.size() == 5);
+}
+
+TEST_CASE("Registries are independent", "[TypeRegistry]") {
+    using Registry = TypeRegistry<int, double, std::string, Blank<0>>;
+    auto basics = makeTypeMap<B>({"int", "double", "string", "void"});
+    Registry first(basics);
+    Registry second(basics);
+
+    // The same names mean different types in each registry, and nested
+    // members are resolved in the registry of the enclosing type
+    first.registerCompoundType(CompoundType("inner", {{"x", {"int"}}}));
+    second.registerCompoundType(
+        CompoundType("inner", {{"x", {"string"}}, {"y", {"double"}}}));
+    first.registerCompoundType(
+        CompoundType("outer", {{"a", {"inner"}}, {"b", {"double"}}}));
+    second.registerCompoundType(
+        CompoundType("outer", {{"a", {"inner"}}, {"b", {"int"}}}));
+    REQUIRE_FALSE(BR::isCompoundType("outer"));
+    REQUIRE(first.describe("int").index == B::indexOf<int>());
+    REQUIRE(first.resolveBasic("string").index == B::indexOf<std::string>());
+    REQUIRE(first.resolveCompound("outer") != second.resolveCompound("outer"));
+
+    std::stringstream in("7 2.5 hi 0.5 3");
+    auto x = first.create("outer", in);
+    REQUIRE(x.get("a").get<int>("x") == 7);
+    REQUIRE(x.get<double>("b") == 2.5);
+    auto y = second.create("outer", in);
+    REQUIRE(y.get("a").get<std::string>("x") == "hi");
+    REQUIRE(y.get("a").get<double>("y") == 0.5);
+    REQUIRE(y.get<int>("b") == 3);
+
+    const auto& outer = second.resolveCompound("outer");
+    REQUIRE(outer.layout()->fields.size() == 3);
+    TextScanner s("a 1.5 2");
+    auto flat = outer.createFlat<BR>(s);
+    REQUIRE(flat.get<std::string>("a.x") == "a");
+    REQUIRE(flat.get<int>("b") == 2);
+
+    // The static resolver is a wrapper around one registry
+    REQUIRE(BR::registry().isBasicType("int"));
+    REQUIRE_FALSE(BR::registry().isCompoundType("inner"));
+}
+
+TEST_CASE("Registries need no static resolver", "[TypeRegistry]") {
+    // No BasicResolver is specialized for these types
+    using Registry = TypeRegistry<long, std::string>;
+    Registry registry(
+        makeTypeMap<Registry::BasicType>({"long", "string"}));
+    registry.registerCompoundType(
+        CompoundType("inner", {{"n", {"long"}}, {"s", {"string"}}}));
+    registry.registerCompoundType(
+        CompoundType("outer", {{"a", {"inner"}}, {"b", {"long"}}}));
+
+    std::stringstream in("1 x 2");
+    auto x = registry.create("outer", in);
+    REQUIRE(x.get("a").get<long>("n") == 1);
+    REQUIRE(x.get<long>("b") == 2);
+
+    TextScanner s("3 y 4");
+    FlatInstance<Registry::Resolver> flat(
+        registry.resolveCompound("outer"), s);
+    REQUIRE(flat.get<std::string>("a.s") == "y");
+    REQUIRE_THROWS_AS(
+        FlatInstance<Registry::Resolver>("outer", s), std::out_of_range);
+}
+
+TEST_CASE("Interns type names", "[BasicResolver]") {
+    BR::registerCompoundType(TestTypes::nestedType);
+    BR::registerCompoundType(TestTypes::multiType);
+
+    const auto& nested = BR::resolveCompound("nestedType");
+    const auto& multi = BR::resolveCompound("multiType");
+    REQUIRE(TestTypes::nestedType.id() == noTypeId);
+    REQUIRE(nested.id() == BR::intern("nestedType"));
+    REQUIRE(nested.id() != multi.id());
+    REQUIRE(nested.members().at("i").id == BR::intern("int"));
+    REQUIRE(BR::intern("int") == BR::intern("int"));
+
+    // Registering a type after it was referred to updates its id
+    auto m = nested.members().at("m").id;
+    REQUIRE(m == multi.id());
+    REQUIRE(BR::describe(m).compound == &multi);
+
+    auto unknown = BR::intern("unknownType");
+    REQUIRE(BR::describe(unknown).kind == TypeDescriptor::Kind::None);
+    REQUIRE(BR::describe(noTypeId).kind == TypeDescriptor::Kind::None);
+    REQUIRE(BR::describe(unknown + 1000).kind == TypeDescriptor::Kind::None);
+
+    REQUIRE(nested == BR::resolveCompound("nestedType"));
+    REQUIRE(nested != multi);
+    REQUIRE(nested == TestTypes::nestedType);
+}
+
 TEST_CASE("Can instantiate compounds", "[CompoundInstance]") {
     std::stringstream ignoreStream("10 Hello");
     std::stringstream intStream("5");
@@ -240,3 +413,658 @@ TEST_CASE("Cannot instantiate incomplete types", "[CompoundType]") {
     REQUIRE_THROWS(TestTypes::incompleteType.create<BR>(emptyStream));
     REQUIRE_THROWS(CompoundInstance<BR>("incompleteType", emptyStream));
 }
+
+TEST_CASE("Registered compounds have a layout", "[CompoundType]") {
+    BR::registerCompoundType(TestTypes::emptyType);
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+    BR::registerCompoundType(TestTypes::incompleteType);
+
+    REQUIRE_FALSE(TestTypes::multiType.layout());
+    REQUIRE_FALSE(BR::resolveCompound("incompleteType").layout());
+
+    const auto& empty = *BR::resolveCompound("emptyType").layout();
+    REQUIRE(empty.size == 0);
+    REQUIRE(empty.fields.empty());
+
+    const auto& nested = *BR::resolveCompound("nestedType").layout();
+    const auto& multi = *BR::resolveCompound("multiType").layout();
+    REQUIRE(nested.fields.size() == 5);
+    REQUIRE(nested.alignment == multi.alignment);
+    REQUIRE(nested.size % nested.alignment == 0);
+    REQUIRE(nested.fields.at("i").offset == 0);
+    REQUIRE(nested.fields.at("i").size == sizeof(int));
+    REQUIRE(nested.fields.at("m.d").alignment == alignof(double));
+    REQUIRE(nested.fields.at("m.d").offset % alignof(double) == 0);
+    REQUIRE(nested.fields.at("m.s2").offset - nested.fields.at("m.i").offset ==
+            multi.fields.at("s2").offset);
+
+    std::vector<std::string> paths;
+    for (const auto& f : nested.fields) {
+        paths.push_back(f.first);
+    }
+    std::vector<std::string> expected = {"i", "m.i", "m.d", "m.s1", "m.s2"};
+    REQUIRE(paths == expected);
+}
+
+TEST_CASE("Types referred to before registration", "[CompoundType]") {
+    using Registry = TypeRegistry<int, double, std::string, Blank<0>>;
+    auto basics = makeTypeMap<B>({"int", "double", "string", "void"});
+    auto inner = CompoundType("inner", {{"x", {"int"}}});
+    auto middle =
+        CompoundType("middle", {{"in", {"inner"}}, {"d", {"double"}}});
+    auto outer = CompoundType("outer", {{"m", {"middle"}}, {"s", {"string"}}});
+
+    // Registering the innermost type last completes every layout
+    std::vector<std::vector<CompoundType>> orders = {
+        {inner, middle, outer}, {outer, middle, inner}, {middle, outer, inner}};
+    for (const auto& order : orders) {
+        Registry registry(basics);
+        for (const auto& type : order) {
+            registry.registerCompoundType(type);
+        }
+        const auto& type = registry.resolveCompound("outer");
+        REQUIRE(type.layout());
+        REQUIRE(type.layout()->fields.size() == 3);
+        TextScanner s("1 2.5 a 3 4.5 b");
+        FlatInstance<Registry::Resolver> flat(type, s);
+        REQUIRE(flat.get<int>("m.in.x") == 1);
+        RecordBatch<Registry::Resolver> batch(type);
+        REQUIRE(batch.read(s) == 1);
+        REQUIRE(batch.get<std::string>(0, "s") == "b");
+    }
+
+    // A type that refers to a missing one stays without a layout
+    Registry registry(basics);
+    registry.registerCompoundType(outer);
+    registry.registerCompoundType(inner);
+    REQUIRE_FALSE(registry.resolveCompound("outer").layout());
+}
+
+TEST_CASE("Can instantiate flat compounds", "[FlatInstance]") {
+    std::stringstream nestedStream("6 10 3.7 hello world");
+    std::stringstream emptyStream("");
+
+    BR::registerCompoundType(TestTypes::emptyType);
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+    BR::registerCompoundType(TestTypes::incompleteType);
+
+    auto nested = FlatInstance<BR>("nestedType", nestedStream);
+    REQUIRE(nested.type() == TestTypes::nestedType);
+    REQUIRE(nested.get<int>("i") == 6);
+    REQUIRE(nested.get<int>("m.i") == 10);
+    REQUIRE(nested.get<double>("m.d") == 3.7);
+    REQUIRE(nested.get<std::string>("m.s1") == "hello");
+    REQUIRE(nested.get<std::string>("m.s2") == "world");
+    REQUIRE_THROWS_AS(nested.get<int>("m"), std::out_of_range);
+    REQUIRE_THROWS_AS(nested.get<int>("m.d"), std::bad_variant_access);
+
+    auto copy = nested;
+    REQUIRE(copy.get<std::string>("m.s2") == "world");
+
+    std::stringstream out;
+    out << copy;
+    REQUIRE(out.str() == "6103.7helloworld");
+
+    auto empty = TestTypes::emptyType.createFlat<BR>(emptyStream);
+    REQUIRE(empty.type() == TestTypes::emptyType);
+
+    REQUIRE_THROWS(FlatInstance<BR>("incompleteType", emptyStream));
+}
+
+TEST_CASE("Can access fields through handles", "[FieldHandle]") {
+    std::stringstream nestedStream("6 10 3.7 hello world");
+
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+    const auto& nestedType = BR::resolveCompound("nestedType");
+
+    auto i = nestedType.field<BR, int>("i");
+    auto mi = nestedType.field<BR, int>("m.i");
+    auto md = nestedType.field<BR, double>("m.d");
+    auto ms2 = nestedType.field<BR, std::string>("m.s2");
+    REQUIRE_THROWS_AS((nestedType.field<BR, int>("m")), std::out_of_range);
+    REQUIRE_THROWS_AS(
+        (nestedType.field<BR, int>("m.d")), std::bad_variant_access);
+    REQUIRE_THROWS((TestTypes::nestedType.field<BR, int>("i")));
+
+    auto nested = nestedType.create<BR>(nestedStream);
+    REQUIRE(nested.get(i) == 6);
+    REQUIRE(nested.get(mi) == 10);
+    REQUIRE(nested.get(md) == 3.7);
+    REQUIRE(nested.get(ms2) == "world");
+
+    nestedStream.clear();
+    nestedStream.seekg(0);
+    auto flat = nestedType.createFlat<BR>(nestedStream);
+    REQUIRE(flat.get(i) == 6);
+    REQUIRE(flat.get(mi) == 10);
+    REQUIRE(flat.get(md) == 3.7);
+    REQUIRE(flat.get(ms2) == "world");
+}
+
+TEST_CASE("Scanning matches reading from a stream", "[TextScanner]") {
+    std::string text = " 6\t10 +3.7\nhello world -4 1e-3 x y";
+
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    std::stringstream stream(text);
+    TextScanner scanner(text);
+
+    auto fromStream = CompoundInstance<BR>("nestedType", stream);
+    auto fromScanner = CompoundInstance<BR>("nestedType", scanner);
+    REQUIRE(fromScanner.get<int>("i") == fromStream.get<int>("i"));
+    const auto& multi = fromScanner.get("m");
+    REQUIRE(multi.get<int>("i") == fromStream.get("m").get<int>("i"));
+    REQUIRE(multi.get<double>("d") == fromStream.get("m").get<double>("d"));
+    REQUIRE(multi.get<std::string>("s1") == "hello");
+    REQUIRE(multi.get<std::string>("s2") == "world");
+
+    auto flatFromStream = FlatInstance<BR>("multiType", stream);
+    auto flatFromScanner = FlatInstance<BR>("multiType", scanner);
+    REQUIRE(flatFromScanner.get<int>("i") == -4);
+    REQUIRE(flatFromScanner.get<double>("d") ==
+            flatFromStream.get<double>("d"));
+    REQUIRE(flatFromScanner.get<std::string>("s2") == "y");
+    REQUIRE_FALSE(scanner.fail());
+
+    // Types without a fast path fall back to operator>>
+    TextScanner intScanner("10");
+    REQUIRE(B::create("int", intScanner).get<int>() == 10);
+    REQUIRE(intScanner.remaining().empty());
+    TextScanner voidScanner("10");
+    B::create<Blank<0>>(voidScanner);
+    REQUIRE(voidScanner.remaining() == "10");
+
+    TextScanner badScanner("abc");
+    REQUIRE(B::create<int>(badScanner).get<int>() == 0);
+    REQUIRE(badScanner.fail());
+    REQUIRE_THROWS_AS(B::create("", badScanner), std::out_of_range);
+}
+
+TEST_CASE("Finds tokens across block boundaries", "[TextScanner]") {
+    // Every byte value, so that the vector kernel agrees with the scalar
+    // one on each
+    std::string bytes;
+    for (int c = 0; c < 256; ++c) {
+        bytes += static_cast<char>(c);
+    }
+    auto kernel = detail::selectSpaceMask();
+    for (std::size_t i = 0; i < bytes.size(); i += 64) {
+        REQUIRE(kernel(bytes.data() + i) ==
+                detail::spaceMaskScalar(bytes.data() + i));
+    }
+
+    // Tokens and runs of whitespace of many lengths, straddling blocks
+    std::string text;
+    std::vector<std::string> expected;
+    const char spaces[] = " \t\n\v\f\r";
+    for (std::size_t n = 1; n < 150; n += 7) {
+        expected.push_back(std::string(n, 'a' + n % 26));
+        text += expected.back();
+        text.append(n % 3 == 0 ? 70 : 1 + n % 5, spaces[n % 6]);
+    }
+    text += "last";
+    expected.push_back("last");
+
+    TextScanner s(text);
+    for (const auto& token : expected) {
+        REQUIRE(s.next() == token);
+    }
+    REQUIRE(s.next().empty());
+    REQUIRE(s.remaining().empty());
+
+    TextScanner empty("");
+    REQUIRE(empty.next().empty());
+}
+
+// Scan a T from text and check that the value, bit for bit, and the
+// input consumed match std::from_chars
+template <typename T>
+void requireScansLikeFromChars(const std::string& text) {
+    T expected{};
+    auto[ptr, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), expected);
+    TextScanner s(text);
+    T x{};
+    detail::scan(s, x);
+    INFO(text);
+    REQUIRE(s.fail() == (ec != std::errc()));
+    if (!s.fail()) {
+        REQUIRE(std::memcmp(&x, &expected, sizeof(T)) == 0);
+        REQUIRE(s.remaining().size() ==
+                static_cast<std::size_t>(text.data() + text.size() - ptr));
+    }
+}
+
+TEST_CASE("Parses numbers like from_chars", "[TextScanner]") {
+    for (const char* text : {"0", "-0", "007", "2147483647", "2147483648",
+             "-2147483648", "-2147483649", "12345678901234567890", "-",
+             "12x", "1234567890123"}) {
+        requireScansLikeFromChars<int>(text);
+        requireScansLikeFromChars<unsigned>(text);
+        requireScansLikeFromChars<long long>(text);
+        requireScansLikeFromChars<std::int16_t>(text);
+    }
+    for (const char* text : {"0", "-0", "0.", ".5", ".", "1e", "1e+",
+             "1.5e-3x", "1E22", "1e23", "9007199254740992",
+             "9007199254740993", "0.1", "3.4028235e38", "1e-400",
+             "123456789012345678901", "1.7976931348623157e308", "inf",
+             "-nan", "2.5e0005"}) {
+        requireScansLikeFromChars<double>(text);
+        requireScansLikeFromChars<float>(text);
+    }
+
+    std::mt19937_64 rng(42);
+    char buf[64];
+    for (int i = 0; i < 10000; ++i) {
+        auto bits = rng();
+        requireScansLikeFromChars<long long>(
+            std::to_string(static_cast<long long>(bits >> (bits % 64))));
+        requireScansLikeFromChars<int>(
+            std::to_string(static_cast<int>(bits >> 32)));
+
+        double d;
+        std::memcpy(&d, &bits, sizeof d);
+        if (!std::isfinite(d)) {
+            continue;
+        }
+        for (const char* format : {"%.17g", "%.6g", "%.3f", "%.2e"}) {
+            std::snprintf(buf, sizeof buf, format, d);
+            requireScansLikeFromChars<double>(buf);
+            requireScansLikeFromChars<float>(buf);
+        }
+        std::snprintf(buf, sizeof buf, "%.4f", (bits % 2000000) / 1000.0);
+        requireScansLikeFromChars<double>(buf);
+        requireScansLikeFromChars<float>(buf);
+    }
+}
+
+TEST_CASE("Can decode from a mapped file", "[MappedFile]") {
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    const std::string path = "test_mapped_file.txt";
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 1000; ++i) {
+            out << i << " " << i << " " << i / 4.0 << " a" << i << " b\n";
+        }
+    }
+
+    MappedFile file(path);
+    std::ifstream in(path);
+    REQUIRE(file.size() == file.view().size());
+    TextScanner s(file.view());
+    for (int i = 0; i < 1000; ++i) {
+        auto fromStream = CompoundInstance<BR>("nestedType", in);
+        auto mapped = CompoundInstance<BR>("nestedType", s);
+        REQUIRE(mapped.get<int>("i") == fromStream.get<int>("i"));
+        REQUIRE(mapped.get("m").get<double>("d") ==
+                fromStream.get("m").get<double>("d"));
+        REQUIRE(mapped.get("m").get<std::string>("s1") ==
+                fromStream.get("m").get<std::string>("s1"));
+    }
+    REQUIRE_FALSE(s.fail());
+    REQUIRE(s.next().empty());
+
+    std::ofstream(path).close();
+    REQUIRE(MappedFile(path).view().empty());
+    std::remove(path.c_str());
+    REQUIRE_THROWS(MappedFile(path));
+}
+
+TEST_CASE("Can decode records fed in chunks", "[RecordParser]") {
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    std::string text;
+    for (int i = 0; i < 20; ++i) {
+        text += std::to_string(i) + "  " + std::to_string(i * 1000) + "\t" +
+                std::to_string(i / 8.0) + " s" + std::to_string(i) +
+                " t\n";
+    }
+
+    // Split the same input into chunks of every size up to a record
+    for (std::size_t size = 1; size < 40; ++size) {
+        RecordParser<BR> parser("nestedType");
+        TextScanner s(text);
+        for (std::size_t pos = 0; pos < text.size(); pos += size) {
+            parser.feed(std::string(text, pos, size));
+            while (parser.available() > 0) {
+                auto x = parser.pop();
+                FlatInstance<BR> expected("nestedType", s);
+                REQUIRE(x.get<int>("i") == expected.get<int>("i"));
+                REQUIRE(x.get<int>("m.i") == expected.get<int>("m.i"));
+                REQUIRE(x.get<double>("m.d") == expected.get<double>("m.d"));
+                REQUIRE(x.get<std::string>("m.s1") ==
+                        expected.get<std::string>("m.s1"));
+                REQUIRE(x.get<std::string>("m.s2") == "t");
+            }
+        }
+        REQUIRE(s.next().empty());
+        REQUIRE_FALSE(parser.inRecord());
+        REQUIRE(parser);
+    }
+
+    // The last token is only known to be complete at the end of input
+    RecordParser<BR> parser("multiType");
+    parser.feed("1 2.5 a b");
+    REQUIRE(parser.available() == 0);
+    REQUIRE(parser.inRecord());
+    parser.finish();
+    REQUIRE(parser.available() == 1);
+    REQUIRE(parser.pop().get<std::string>("s2") == "b");
+    REQUIRE_THROWS_AS(parser.pop(), std::out_of_range);
+
+    parser.feed("x ");
+    REQUIRE(parser.fail());
+    parser.feed("1 2.5 a b ");
+    REQUIRE(parser.available() == 0);
+
+    // Trailing fields that read nothing complete a record, as in a batch
+    BR::registerCompoundType(
+        CompoundType("trailingVoid", {{"i", {"int"}}, {"v", {"void"}}}));
+    RecordParser<BR> trailing("trailingVoid");
+    trailing.feed("1 2 3 ");
+    trailing.finish();
+    REQUIRE(trailing.available() == 3);
+    REQUIRE_FALSE(trailing.inRecord());
+    REQUIRE(trailing);
+    RecordBatch<BR> batch("trailingVoid");
+    TextScanner s("1 2 3 ");
+    REQUIRE(batch.read(s) == 3);
+
+    // A token that no field reads is an error
+    BR::registerCompoundType(TestTypes::emptyType);
+    RecordParser<BR> empty("emptyType");
+    empty.feed("1 ");
+    REQUIRE(empty.fail());
+    REQUIRE(empty.available() == 0);
+}
+
+TEST_CASE("Can decode records on several threads", "[RecordBatch]") {
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    std::string text;
+    for (int i = 0; i < 5000; ++i) {
+        text += std::to_string(i) + (i % 7 == 0 ? "\n" : " ") +
+                std::to_string(-i) + "  " + std::to_string(i / 4.0) + " s" +
+                std::to_string(i) + "\tt ";
+    }
+
+    for (unsigned threads = 1; threads <= 5; ++threads) {
+        auto batches = decodeParallel<BR>("nestedType", text, threads);
+        REQUIRE(batches.size() == threads);
+        int i = 0;
+        for (const auto& batch : batches) {
+            // Every thread gets a share of the records
+            REQUIRE(batch.size() > 0);
+            for (std::size_t j = 0; j < batch.size(); ++j, ++i) {
+                REQUIRE(batch.get<int>(j, "i") == i);
+                REQUIRE(batch.get<int>(j, "m.i") == -i);
+                REQUIRE(batch.get<double>(j, "m.d") == i / 4.0);
+                REQUIRE(batch.get<std::string>(j, "m.s1") ==
+                        "s" + std::to_string(i));
+            }
+        }
+        REQUIRE(i == 5000);
+    }
+
+    // Nothing after a record that fails to parse is returned
+    auto bad = text;
+    bad.replace(bad.find(" 3000 "), 6, " x ");
+    std::size_t count = 0;
+    for (const auto& batch : decodeParallel<BR>("nestedType", bad, 4)) {
+        count += batch.size();
+    }
+    REQUIRE(count == 3000);
+
+    // Fields that are not one token each cannot be counted, so such
+    // types are decoded sequentially
+    BR::registerCompoundType(CompoundType(
+        "withVoid", {{"i", {"int"}}, {"v", {"void"}}, {"d", {"double"}}}));
+    std::string withVoid;
+    for (int i = 0; i < 20000; ++i) {
+        withVoid += std::to_string(i) + " 0.5 ";
+    }
+    auto batches = decodeParallel<BR>("withVoid", withVoid, 4);
+    REQUIRE(batches.size() == 1);
+    REQUIRE(batches[0].size() == 20000);
+    REQUIRE(batches[0].get<int>(19999, "i") == 19999);
+}
+
+TEST_CASE("Can round trip the binary format", "[CompoundInstance]") {
+    std::stringstream nestedStream("6 10 3.7 hello world");
+
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+    auto nested = CompoundInstance<BR>("nestedType", nestedStream);
+
+    std::stringstream binaryStream;
+    nested.writeBinary(binaryStream);
+    auto bytes = binaryStream.str();
+    // Two ints, a double, and two strings with 8 byte length prefixes
+    REQUIRE(bytes.size() == 4 + 4 + 8 + (8 + 5) + (8 + 5));
+    REQUIRE(bytes.substr(0, 4) == std::string("\x06\0\0\0", 4));
+    REQUIRE(bytes.substr(16, 8) == std::string("\x05\0\0\0\0\0\0\0", 8));
+
+    auto fromBinary = CompoundInstance<BR>("nestedType", binaryStream, binary);
+    REQUIRE(fromBinary.get<int>("i") == 6);
+    const auto& multi = fromBinary.get("m");
+    REQUIRE(multi.get<int>("i") == 10);
+    REQUIRE(multi.get<double>("d") == 3.7);
+    REQUIRE(multi.get<std::string>("s1") == "hello");
+    REQUIRE(multi.get<std::string>("s2") == "world");
+
+    binaryStream.seekg(0);
+    auto flat = TestTypes::nestedType.createFlat<BR>(binaryStream, binary);
+    REQUIRE(flat.get<double>("m.d") == 3.7);
+    REQUIRE(flat.get<std::string>("m.s2") == "world");
+
+    std::stringstream flatStream;
+    flat.writeBinary(flatStream);
+    REQUIRE(flatStream.str() == bytes);
+
+    std::stringstream truncatedStream(bytes.substr(0, 10));
+    CompoundInstance<BR>("nestedType", truncatedStream, binary);
+    REQUIRE(truncatedStream.fail());
+}
+
+TEST_CASE("Rejects corrupt binary strings", "[Basic]") {
+    auto prefixed = [](std::uint64_t size, const std::string& data) {
+        std::string bytes;
+        for (int i = 0; i < 8; ++i) {
+            bytes += static_cast<char>((size >> (8 * i)) & 0xFF);
+        }
+        return bytes + data;
+    };
+
+    std::stringstream valid(prefixed(70000, std::string(70000, 'x')));
+    std::string x;
+    detail::readBinary(valid, x);
+    REQUIRE(valid);
+    REQUIRE(x == std::string(70000, 'x'));
+
+    std::stringstream truncated(prefixed(100000, std::string(70000, 'y')));
+    REQUIRE_NOTHROW(detail::readBinary(truncated, x));
+    REQUIRE(truncated.fail());
+    REQUIRE(x == std::string(70000, 'y'));
+
+    // A length far beyond the input must not be allocated up front
+    std::stringstream huge(prefixed(std::uint64_t(1) << 62, "abc"));
+    REQUIRE_NOTHROW(detail::readBinary(huge, x));
+    REQUIRE(huge.fail());
+    REQUIRE(x == "abc");
+}
+
+TEST_CASE("Can decode records in a batch", "[RecordBatch]") {
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    std::stringstream text("6 10 3.7 hello world\n7 11 4.5 a b\n"
+                           "8 12 5.25 c d\n");
+    auto batch = TestTypes::nestedType.createBatch<BR>(text, 10);
+    REQUIRE(batch.size() == 3);
+    REQUIRE(batch.capacity() == 10);
+    REQUIRE(batch.get<int>(0, "i") == 6);
+    REQUIRE(batch.get<std::string>(1, "m.s1") == "a");
+    auto d = batch.type().field<BR, double>("m.d");
+    REQUIRE(batch.get(2, d) == 5.25);
+    REQUIRE_THROWS_AS(batch.get<int>(0, "m.d"), std::bad_variant_access);
+
+    std::stringstream binaryStream;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        batch.writeBinary(binaryStream, i);
+    }
+    auto fromBinary =
+        TestTypes::nestedType.createBatch<BR>(binaryStream, 2, binary);
+    REQUIRE(fromBinary.size() == 2);
+    REQUIRE(fromBinary.get<std::string>(1, "m.s2") == "b");
+
+    // Growing past the reserved capacity keeps the earlier records
+    std::string records;
+    for (int i = 0; i < 100; ++i) {
+        records += std::to_string(i) + " 1 2.5 x y ";
+    }
+    TextScanner s(records);
+    RecordBatch<BR> grown("nestedType");
+    REQUIRE(grown.read(s) == 100);
+    REQUIRE(grown.size() == 100);
+    REQUIRE(grown.get<int>(0, "i") == 0);
+    REQUIRE(grown.get<int>(99, "i") == 99);
+    std::stringstream out;
+    grown.write(out, 42);
+    REQUIRE(out.str() == "4212.5xy");
+
+    // Records that read nothing stop reading rather than repeat forever
+    BR::registerCompoundType(TestTypes::emptyType);
+    BR::registerCompoundType(
+        CompoundType("allVoid", {{"a", {"void"}}, {"b", {"void"}}}));
+    for (auto name : {"emptyType", "allVoid"}) {
+        TextScanner scanner("1 2");
+        REQUIRE(RecordBatch<BR>(name).read(scanner) == 0);
+        std::stringstream stream("1 2");
+        REQUIRE(RecordBatch<BR>(name).read(stream) == 0);
+        REQUIRE(decodeParallel<BR>(name, records, 4)[0].empty());
+    }
+}
+
+TEST_CASE("Can store records by column", "[ColumnBatch]") {
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    std::stringstream text("6 10 3.7 hello world\n7 11 4.5 a b\n"
+                           "8 12 5.25 c d\n9 13");
+    ColumnBatch<BR> columns("nestedType");
+    REQUIRE(columns.read(text) == 3);
+    REQUIRE(columns.size() == 3);
+
+    const auto& d = columns.column<double>("m.d");
+    REQUIRE((d == std::vector<double>{3.7, 4.5, 5.25}));
+    REQUIRE((columns.column<int>("i") == std::vector<int>{6, 7, 8}));
+    REQUIRE(columns.column<std::string>("m.s2").back() == "d");
+    REQUIRE_THROWS_AS(columns.column<int>("m.d"), std::bad_variant_access);
+    REQUIRE_THROWS_AS(columns.column<int>("m"), std::out_of_range);
+
+    std::stringstream out;
+    columns.write(out, 1);
+    REQUIRE(out.str() == "7114.5ab");
+
+    TextScanner s("1 2 0.5 x y");
+    REQUIRE(columns.read(s, 1) == 1);
+    REQUIRE(columns.column<std::string>("m.s1")[3] == "x");
+
+    columns.clear();
+    REQUIRE(columns.empty());
+    REQUIRE(columns.column<double>("m.d").empty());
+
+    // Rows that read nothing stop reading rather than repeat forever
+    BR::registerCompoundType(TestTypes::emptyType);
+    BR::registerCompoundType(
+        CompoundType("allVoid", {{"a", {"void"}}, {"b", {"void"}}}));
+    for (auto name : {"emptyType", "allVoid"}) {
+        TextScanner scanner("1 2");
+        REQUIRE(ColumnBatch<BR>(name).read(scanner) == 0);
+        std::stringstream stream("1 2");
+        REQUIRE(ColumnBatch<BR>(name).read(stream) == 0);
+    }
+}
+
+// Memory resource that counts outstanding allocations
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::size_t allocated = 0;
+    std::size_t outstanding = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++allocated;
+        ++outstanding;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(
+        void* p, std::size_t bytes, std::size_t alignment) override {
+        --outstanding;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+TEST_CASE("Can allocate compounds from a memory resource",
+    "[CompoundInstance]") {
+    std::stringstream nestedStream("6 10 3.7 hello world");
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    CountingResource counter;
+    {
+        CompoundInstance<BR> nested(&counter, "nestedType", nestedStream);
+        REQUIRE(nested.resource() == &counter);
+        REQUIRE(nested.get("m").resource() == &counter);
+        REQUIRE(nested.get("m").get<std::string>("s2") == "world");
+        // One basic member, one compound and four nested basic members.
+        // Small compounds keep their member maps inline.
+        REQUIRE(counter.allocated == 6);
+
+        auto copy = nested;
+        REQUIRE(copy.resource() == std::pmr::get_default_resource());
+        REQUIRE(copy.get("m").get<double>("d") == 3.7);
+
+        CompoundInstance<BR> arenaCopy(&counter, copy);
+        REQUIRE(arenaCopy.get("m").resource() == &counter);
+    }
+    REQUIRE(counter.outstanding == 0);
+
+    std::pmr::monotonic_buffer_resource arena;
+    nestedStream.clear();
+    nestedStream.seekg(0);
+    auto inArena = CompoundInstance<BR>(&arena, "nestedType", nestedStream);
+    REQUIRE(inArena.get<int>("i") == 6);
+}
+
+TEST_CASE("Instances know their kind", "[CompoundInstance]") {
+    std::stringstream nestedStream("6 10 3.7 hello world");
+    BR::registerCompoundType(TestTypes::multiType);
+    BR::registerCompoundType(TestTypes::nestedType);
+
+    CompoundInstance<BR> nested("nestedType", nestedStream);
+    using Kind = detail::TypeInstance::Kind;
+    REQUIRE(nested.kind() == Kind::Compound);
+    REQUIRE(nested("i").kind() == Kind::Basic);
+    REQUIRE(nested("m").kind() == Kind::Compound);
+
+    auto clone = nested.clone(std::pmr::get_default_resource());
+    REQUIRE(clone->kind() == Kind::Compound);
+    const auto& cloned = static_cast<const CompoundInstance<BR>&>(*clone);
+    REQUIRE(cloned.get("m").get<std::string>("s1") == "hello");
+    REQUIRE_THROWS_AS(cloned.get("i"), std::bad_cast);
+}